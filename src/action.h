@@ -1,84 +1,65 @@
 #pragma once
-#include <algorithm>
-#include <unordered_map>
+#include <cstdint>
+#include <iostream>
 #include <string>
-#include "board.h"
+#include <type_traits>
 
+/**
+ * compact move, trivially copyable in 16 bits
+ *
+ *  bit 0~5 : origin square
+ *  bit 6~11: destination square
+ *  bit 12  : capture flag
+ *
+ * square 0 is on the border, so code 0 means no action
+ */
 class Action {
 public:
-	Action(unsigned code = -1u) : code(code) {}
-	Action(const Action& a) : code(a.code) {}
-	virtual ~Action() {}
+	Action(unsigned code = 0) : code(code) {}
 
-	class Eat; 	// create a eating action
-	class Move; // create a moving action
+	static Action Eat(unsigned ori, unsigned dest) { return Action(eat_flag | (ori & 0b111111) | ((dest & 0b111111) << 6)); }
+	static Action Eat(unsigned code) { return Action(eat_flag | code); }
+	static Action Move(unsigned ori, unsigned dest) { return Action((ori & 0b111111) | ((dest & 0b111111) << 6)); }
+	static Action Move(unsigned code) { return Action(code & ~eat_flag); }
 
-public:
-	virtual int apply(Board& b) const {
-		auto proto = entries().find(type());
-		if (proto != entries().end()) return proto->second->reinterpret(this).apply(b);
-		return -1;
-	}
-	virtual std::ostream& operator >>(std::ostream& out) const {
-        auto proto = entries().find(type());
-        if (proto != entries().end()) return proto->second->reinterpret(this) >> out;
-        return out << "??";
-    }
-    virtual std::istream& operator <<(std::istream& in) {
-        auto state = in.rdstate();
-        for (auto proto = entries().begin(); proto != entries().end(); proto++) {
-            if (proto->second->reinterpret(this) << in) return in;
-            in.clear(state);
-        }
-        return in.ignore(2);
-    }
+	static const unsigned eat_flag = 1 << 12;
 
 public:
 	operator unsigned() const { return code; }
-	unsigned type() const { return code & type_flag(-1u); }
 	unsigned origin() const { return code & 0b111111; }
 	unsigned destination() const { return (code >> 6) & 0b111111; }
+	bool is_eat() const { return code & eat_flag; }
+	bool is_none() const { return code == 0; }
+	std::string name() const { return is_none() ? "none" : is_eat() ? "eat" : "move"; }
 
-protected:
-	static constexpr unsigned type_flag(unsigned v) { return v << 24; }
-
-	typedef std::unordered_map<unsigned, Action*> prototype;
-	static prototype& entries() { static prototype m; return m; }
-	virtual Action& reinterpret(const Action* a) const { return *new (const_cast<Action*>(a)) Action(*a); }
-
-	unsigned code;
-};
-
-class Action::Eat : public Action {
-public:
-	static constexpr unsigned type = type_flag('e');
-	Eat(unsigned ori, unsigned dest) : Action(Eat::type | (ori & 0b111111) | ((dest & 0b111111) << 6)) {}
-	Eat(unsigned code) : Action(Eat::type | code) {}
-	Eat(const Action& a = {}) : Action(a) {}
-
-public:
-	int apply(Board& b) const {
-		return b.eat(origin(), destination());
+	// square notation of tournament mode, row then column, e.g. 17 is "2a"
+	static std::string square(unsigned i) {
+		return std::to_string(i / 8) + char(i % 8 + 'a' - 1);
+	}
+	static unsigned square(const std::string& s) {
+		return (s.at(0) - '0') * 8 + (s.at(1) - 'a' + 1);
 	}
-
-protected:
-	Action& reinterpret(const Action* a) const { return *new (const_cast<Action*>(a)) Eat(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('e')] = new Eat; }
-};
-
-class Action::Move : public Action {
-public:
-	static constexpr unsigned type = type_flag('m');
-	Move(unsigned ori, unsigned dest) : Action(Move::type | (ori & 0b111111) | ((dest & 0b111111) << 6)) {}
-	Move(unsigned code) : Action(Move::type | code) {}
-	Move(const Action& a = {}) : Action(a) {}
 
 public:
-	int apply(Board& b) const {
-		return b.move(origin(), destination());
+	// "2a-3b" for moving, "2ax3b" for eating, "--" for no action
+	friend std::ostream& operator <<(std::ostream& out, const Action& a) {
+		if (a.is_none()) return out << "--";
+		return out << square(a.origin()) << (a.is_eat() ? 'x' : '-') << square(a.destination());
+	}
+	friend std::istream& operator >>(std::istream& in, Action& a) {
+		char buf[5] = { 0 };
+		if (in.read(buf, 2) && buf[0] == '-' && buf[1] == '-') {
+			a = Action();
+			return in;
+		}
+		if (!in.read(buf + 2, 3)) return in;
+		unsigned ori = square(std::string(buf, 2)), dest = square(std::string(buf + 3, 2));
+		a = (buf[2] == 'x') ? Eat(ori, dest) : Move(ori, dest);
+		return in;
 	}
 
-protected:
-	Action& reinterpret(const Action* a) const { return *new (const_cast<Action*>(a)) Move(*a); }
-	static __attribute__((constructor)) void init() { entries()[type_flag('m')] = new Move; }
+private:
+	uint16_t code;
 };
+
+static_assert(sizeof(Action) == 2 && std::is_trivially_copyable<Action>::value, "Action should be a 16-bit POD");
@@ -2,16 +2,15 @@
 #include <algorithm>
 #include <vector>
 #include <random>
-#include <bitset>
-#include <unordered_map>
 #include <iterator>
 #include <unistd.h>
 #include "board.h"
+#include "movelist.h"
+#include "repetition.h"
 #include "action.h"
 #include "utilities.h"
 #include "tuple.h"
 #include "mcts.h"
-typedef std::bitset<256> bs256;
 
 class Agent {
 public:
@@ -40,7 +39,7 @@ public:
         RandomAgent(),
         color(color),
         tuple(tuple),
-        epsilon(epsilon) { repetition.reserve(400); }
+        epsilon(epsilon), repetition(400) {}
 
     std::string role() { return color ? "White" : "Black"; }
 
@@ -54,6 +53,7 @@ public:
         for (Board b : record) {
             tuple->train_weight(b, result, 0);
         }
+        tuple->flush_updates();
     }
 
     void epsilon_decay() {
@@ -65,43 +65,26 @@ public:
     virtual Action take_action(const Board& before) {
         Board tmp = Board(before);
         MCTS mcts(tuple, true, true, 1600, rd(), epsilon);
-        std::pair<std::string, unsigned> prev_action = mcts.training(tmp, color, 2);
+        Action prev_action = mcts.training(tmp, color, 2);
         record.emplace_back(tmp.get_board(0 ^ color), tmp.get_board(1 ^ color));
 
-        std::string type = prev_action.first;
-        unsigned code = prev_action.second;
-        if (type == "eat") {
-            return Action::Eat(code);
-        }
-        if (type == "move") {
-            if(set_repitition(before, tmp) > 2) return Action();
-            return Action::Move(code);
-        }
         // cannot find valid action
-        return Action();
+        if (prev_action.is_none()) return Action();
+        if (!prev_action.is_eat() && set_repitition(before) > 2) return Action();
+        return prev_action;
     }
 
 private:
-    int set_repitition(const Board& before, const Board& after) {
-        bs256 tmpbs = (bs256(before.get_board(1)) << 192) |
-                      (bs256(before.get_board(0)) << 128) |
-                      (bs256(before.get_board(1)) << 64)  |
-                      bs256(before.get_board(0));
-
-        auto iter = repetition.find(tmpbs);
-        if (iter == repetition.end()) {
-            repetition.insert({ tmpbs, 1 });
-            return 1;
-        }
-        return ++(iter->second);
+    int set_repitition(const Board& before) {
+        return repetition.add(before.get_hash());
     }
 
 private:
     unsigned color; // 0 for black or 1 for white
     std::vector<Board> record;
-    std::unordered_map<bs256,int> repetition;
     Tuple *tuple;
     float epsilon;
+    Repetition repetition;
 };
 
 class TuplePlayer : public RandomAgent {
@@ -111,42 +94,22 @@ public:
 public:
     // choose best action with tuple value
     void playing(Board &board, int player) {
-        std::vector<unsigned> eats, moves;
-        eats.clear(); moves.clear();
-        board.get_possible_eat(eats, player);
-        board.get_possible_move(moves, player);
+        MoveList actions;
+        board.get_possible_action(actions, player);
+
+        float values[MoveList::capacity];
+        tuple->get_action_values(tuple->get_tuple_index(board, player), actions, player, values);
 
         float best_value = -1e9;
-        unsigned best_code = 0;
-        int best_action_type;
-
-        for (unsigned code : eats) {
-            Board tmp = Board(board);
-            tmp.eat(code & 0b111111, (code >> 6) & 0b111111);
-            float value = tuple->get_board_value(tmp, player);
-            if (value > best_value) {
-                best_value = value;
-                best_code = code;
-                best_action_type = 0;
-            }
-        }
-        for (unsigned code : moves) {
-            Board tmp = Board(board);
-            tmp.move(code & 0b111111, (code >> 6) & 0b111111);
-            float value = tuple->get_board_value(tmp, player);
-            if (value > best_value) {
-                best_value = value;
-                best_code = code;
-                best_action_type = 1;
+        Action best_action;
+        for (unsigned i = 0; i < actions.size(); i++) {
+            if (values[i] > best_value) {
+                best_value = values[i];
+                best_action = actions[i];
             }
         }
 
-        if (best_code != 0) {
-            if (!best_action_type) 
-                board.eat(best_code & 0b111111, (best_code >> 6) & 0b111111);
-            else
-                board.move(best_code & 0b111111, (best_code >> 6) & 0b111111);
-        }
+        if (!best_action.is_none()) board.apply(best_action);
     }
 
 private:
@@ -155,23 +118,17 @@ private:
 
 class RandomPlayer : public RandomAgent {
 public:
-    RandomPlayer() : RandomAgent() {}
-    RandomPlayer(int seed) : RandomAgent() { engine.seed(seed); }
+    RandomPlayer() : RandomAgent() { random.seed(rd()); }
+    RandomPlayer(int seed) : RandomAgent() { engine.seed(seed); random.seed(seed); }
 
 public:
     void playing(Board &board, int player) {
         // random play with eat first
-        std::vector<unsigned> eats, moves;
-        board.get_possible_eat(eats, player);
-        board.get_possible_move(moves, player);
-        std::shuffle(eats.begin(), eats.end(), engine);
-        std::shuffle(moves.begin(), moves.end(), engine);
-
-        if (eats.size() > 0) {
-            board.eat(eats[0] & 0b111111, (eats[0] >> 6) & 0b111111);
-        }
-        else if (moves.size() > 0) {
-            board.move(moves[0] & 0b111111, (moves[0] >> 6) & 0b111111);
-        }
+        Action action = board.get_random_eat(player, random);
+        if (action.is_none()) action = board.get_random_move(player, random);
+        if (!action.is_none()) board.apply(action);
     }
-};
+
+private:
+    FastRandom random;
+};
\ No newline at end of file
@@ -0,0 +1,291 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <thread>
+#include "board.h"
+#include "action.h"
+#include "movelist.h"
+#include "tuple.h"
+#include "mcts.h"
+#include "utilities.h"
+
+/**
+ * benchmark: time the evaluation kernels on positions from random games
+ *
+ * --bench               run the benchmark
+ * --positions=N         number of positions (100000 by default)
+ * --simulations=N       simulations per MCTS move (5000 by default)
+ * --threads=N           most search threads to time (the cores by default)
+ * --tuple=...           arguments of the tuple network, e.g. load=...
+ * --verify              check the value cache across a wrap of its version
+ */
+
+// keeps the timed results alive
+static volatile uint64_t bench_sink;
+
+double bench_seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// positions along random games, with the side to move
+std::vector<std::pair<Board, int>> bench_positions(size_t count, uint32_t seed = 7) {
+    std::vector<std::pair<Board, int>> positions;
+    FastRandom random(seed);
+    while (positions.size() < count) {
+        Board board;
+        int player = 0;
+        for (int i = 0; i < 200 && !board.game_over() && positions.size() < count; i++) {
+            positions.emplace_back(board, player);
+            Action action = board.get_random_eat(player, random);
+            if (action.is_none()) action = board.get_random_move(player, random);
+            if (action.is_none()) break;
+            board.apply(action);
+            player ^= 1;
+        }
+    }
+    return positions;
+}
+
+// time get_tuple_index with each index kernel, and check them against the loop kernel
+void bench_index_kernels(Tuple &tuple, const std::vector<std::pair<Board, int>> &positions) {
+    const std::string current = tuple.get_index_kernel();
+    std::vector<TupleIndex> reference;
+    tuple.set_index_kernel("loop");
+    for (const auto &p : positions) reference.push_back(tuple.get_tuple_index(p.first, p.second));
+
+    for (const char* name : { "loop", "gather", "pext" }) {
+        if (!tuple.set_index_kernel(name)) {
+            std::cout << std::left << std::setw(8) << name << std::right << "not supported" << std::endl;
+            continue;
+        }
+        bool same = true;
+        for (size_t i = 0; i < positions.size(); i++) {
+            TupleIndex index = tuple.get_tuple_index(positions[i].first, positions[i].second);
+            same &= std::memcmp(index.value, reference[i].value, tuple.tuple_count() * sizeof(index.value[0])) == 0;
+        }
+
+        uint64_t calls = 0, checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            for (const auto &p : positions) checksum += tuple.get_tuple_index(p.first, p.second).value[0][7];
+            calls += positions.size();
+        } while (bench_seconds(start) < 0.5);
+        double sec = bench_seconds(start);
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+                  << sec * 1e9 / calls << " ns/board" << (same ? "" : "  MISMATCH") << std::endl;
+        bench_sink = checksum;
+    }
+    tuple.set_index_kernel(current);
+}
+
+// time get_board_value with each storage format, and compare the values against float
+void bench_weight_formats(const std::string &tuple_args, const std::vector<std::pair<Board, int>> &positions) {
+    std::vector<float> reference;
+    for (const char* name : { "float", "int16", "fp16", "int8" }) {
+        auto load = std::chrono::steady_clock::now();
+        Tuple tuple(tuple_args + " weight=" + name);
+        const double load_ms = bench_seconds(load) * 1000;
+        double error = 0;
+        for (size_t i = 0; i < positions.size(); i++) {
+            float value = tuple.get_board_value(positions[i].first, positions[i].second);
+            if (reference.size() < positions.size()) reference.push_back(value);
+            error = std::max(error, double(std::fabs(value - reference[i])));
+        }
+
+        uint64_t calls = 0;
+        float sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            for (const auto &p : positions) sum += tuple.get_board_value(p.first, p.second);
+            calls += positions.size();
+        } while (bench_seconds(start) < 0.5);
+        double sec = bench_seconds(start);
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+                  << sec * 1e9 / calls << " ns/board, " << std::setprecision(1) << tuple.get_weight_bytes() / 1048576.0 << " MB, "
+                  << load_ms << " ms to load, "
+                  << std::scientific << std::setprecision(2) << "max error " << error << std::defaultfloat << std::endl;
+        bench_sink = uint64_t(sum);
+        std::cout << "        " << tuple.placement() << std::endl;
+    }
+}
+
+// time the children of each position one by one against the batched calls, with batching on
+void bench_batch(Tuple &tuple, const std::vector<std::pair<Board, int>> &positions) {
+    const char* name[] = { "board", "boards", "index", "indices" };
+    const bool batching = tuple.get_batching();
+    tuple.set_batching(1);
+    std::vector<float> reference;
+    for (int mode = 0; mode < 4; mode++) {
+        uint64_t children = 0;
+        float sum = 0;
+        bool same = true;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            size_t k = 0;
+            for (const auto &p : positions) {
+                MoveList actions;
+                Board boards[MoveList::capacity];
+                float values[MoveList::capacity];
+                p.first.get_possible_action(actions, p.second);
+                const TupleIndex index = tuple.get_tuple_index(p.first, p.second);
+                if (mode <= 1) {
+                    for (size_t i = 0; i < actions.size(); i++) {
+                        boards[i] = p.first;
+                        boards[i].apply(actions[i]);
+                    }
+                }
+                switch (mode) {
+                    case 0:
+                        for (size_t i = 0; i < actions.size(); i++) values[i] = tuple.get_board_value(boards[i], p.second);
+                        break;
+                    case 1:
+                        tuple.get_board_values(boards, actions.size(), p.second, values);
+                        break;
+                    case 2:
+                        for (size_t i = 0; i < actions.size(); i++) {
+                            TupleIndex child;
+                            tuple.copy_index(child, index);
+                            tuple.update_tuple_index(child, actions[i], p.second, p.second);
+                            values[i] = tuple.get_index_value(child);
+                        }
+                        break;
+                    case 3:
+                        tuple.get_action_values(index, actions, p.second, values);
+                        break;
+                }
+                for (size_t i = 0; i < actions.size(); i++, k++) {
+                    if (reference.size() <= k) reference.push_back(values[i]);
+                    same &= values[i] == reference[k];
+                    sum += values[i];
+                }
+                children += actions.size();
+            }
+        } while (bench_seconds(start) < 0.5);
+        double sec = bench_seconds(start);
+        std::cout << std::left << std::setw(8) << name[mode] << std::right << std::fixed << std::setprecision(1)
+                  << sec * 1e9 / children << " ns/child" << (same ? "" : "  MISMATCH") << std::endl;
+        bench_sink = uint64_t(sum);
+    }
+    tuple.set_batching(batching);
+    std::cout << "batching " << (batching ? "on" : "off") << " for these tables" << std::endl;
+}
+
+// time MCTS searches from some of the positions, as tournament mode plays them
+void bench_search(Tuple &tuple, const std::vector<std::pair<Board, int>> &positions, int simulations) {
+    MCTS mcts(&tuple, true, false, simulations);
+    const size_t count = std::min(positions.size(), size_t(20));
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        Board board = positions[i * (positions.size() / count)].first;
+        mcts.playing(board, positions[i * (positions.size() / count)].second, 1);
+    }
+    double sec = bench_seconds(start);
+    std::cout << std::left << std::setw(8) << "search" << std::right << std::fixed << std::setprecision(1)
+              << sec * 1000 / count << " ms/move (" << simulations << " simulations), tree "
+              << std::setprecision(1) << mcts.get_tree().bytes() / 1048576.0 << " MB, cache " << tuple.cache_stats() << std::endl;
+}
+
+// simulations per second of the search with 1, 2, 4, ... up to threads threads
+void bench_threads(Tuple &tuple, const std::vector<std::pair<Board, int>> &positions, int simulations, unsigned threads) {
+    const size_t count = std::min(positions.size(), size_t(20));
+    double single = 0;
+    for (unsigned n = 1; ; n = std::min(n * 2, threads)) {
+        MCTS mcts(&tuple, true, false, simulations, 10, 0.9, n);
+        mcts.set_reuse(false);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            Board board = positions[i * (positions.size() / count)].first;
+            mcts.playing(board, positions[i * (positions.size() / count)].second, 1);
+        }
+        const double rate = simulations * count / bench_seconds(start);
+        if (n == 1) single = rate;
+        std::cout << std::left << std::setw(8) << n << std::right << std::fixed << std::setprecision(0)
+                  << rate << " simulations/s, " << std::setprecision(2) << rate / single << "x" << std::endl;
+        if (n == threads) break;
+    }
+}
+
+/**
+ * the cache starts just before the low half of its version wraps to 0, where an empty entry
+ * looks like one of version 0, 2^32 versions old
+ */
+int cache_verify() {
+    int failed = 0;
+    auto check = [&](const std::string& what, bool ok) {
+        std::cout << what << (ok ? ": ok" : ": FAIL") << std::endl;
+        if (!ok) failed++;
+    };
+    EvalCache cache(1, (1ULL << 32) - 1);
+    const uint64_t key = EvalCache::mix(1), other = EvalCache::mix(2);
+    float value = 0;
+    cache.store(key, 1.5f, cache.current());
+    check("value found at its version", cache.probe(key, value) && value == 1.5f);
+    cache.invalidate();
+    check("value dropped when the version wraps", !cache.probe(key, value));
+    check("empty entry not found after the wrap", !cache.probe(0, value));
+    cache.store(other, 2.5f, cache.current() - 1);
+    check("value of the version before not stored", !cache.probe(other, value));
+    cache.store(other, 2.5f, cache.current());
+    check("value found after the wrap", cache.probe(other, value) && value == 2.5f);
+    std::cout << (failed ? "cache verify failed" : "cache verify passed") << std::endl;
+    return failed ? 1 : 0;
+}
+
+/* command line interface to time the evaluation */
+int benchmark(int argc, const char* argv[]) {
+    size_t count = 100000;
+    int simulations = 5000;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string tuple_args;
+    bool verify = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string para(argv[i]);
+        if (para.find("--positions=") == 0) {
+            count = std::stoul(para.substr(para.find("=") + 1));
+        } else if (para.find("--simulations=") == 0) {
+            simulations = std::stoi(para.substr(para.find("=") + 1));
+        } else if (para.find("--threads=") == 0) {
+            threads = std::max(1ul, std::stoul(para.substr(para.find("=") + 1)));
+        } else if (para.find("--tuple=") == 0) {
+            tuple_args = para.substr(para.find("=") + 1);
+        } else if (para.find("--verify") == 0) {
+            verify = true;
+        }
+    }
+    if (verify) return cache_verify();
+
+    std::vector<std::pair<Board, int>> positions = bench_positions(count);
+    size_t tuples;
+    {
+        Tuple tuple(tuple_args);
+        std::cout << positions.size() << " positions, index kernel " << tuple.get_index_kernel()
+                  << ", weight format " << tuple.get_weight_format() << std::endl;
+        std::cout << "tuple shapes " << tuple.get_shapes() << std::endl;
+        tuples = tuple.tuple_count();
+
+        std::cout << std::endl << "tuple index (8 images, " << tuples << " tuples)" << std::endl;
+        bench_index_kernels(tuple, positions);
+
+        std::cout << std::endl << "children (serial board / batched boards / serial index / batched indices)" << std::endl;
+        bench_batch(tuple, positions);
+
+        std::cout << std::endl << "search without and with a 64 MB value cache" << std::endl;
+        bench_search(tuple, positions, simulations);
+        tuple.set_cache(64);
+        bench_search(tuple, positions, simulations);
+
+        std::cout << std::endl << "search threads, with the cache" << std::endl;
+        bench_threads(tuple, positions, simulations, threads);
+        tuple.set_cache(0);
+    }
+
+    std::cout << std::endl << "board value (" << tuples * 8 << " weights)" << std::endl;
+    bench_weight_formats(tuple_args, positions);
+    return 0;
+}
@@ -1,268 +1,679 @@
-#pragma once
-#include <array>
-#include <iostream>
-#include <vector>
-#include "utilities.h"
-
-#define F_LAYER 0x0055005500550055ULL
-#define S_LAYER 0x0000333300003333ULL
-#define T_LAYER 0x000000000F0F0F0FULL
-#define BORDER  0xFF818181818181FFULL
-
-/**
- * bitboard for Surakarta
- *  (0)  (1)  (2)  (3)  (4)  (5)  (6)  (7)
- *  (8)  (9) (10) (11) (12) (13) (14) (15)
- * (16) (17) (18) (19) (20) (21) (22) (23)
- * (24) (25) (26) (27) (28) (29) (30) (31)
- * (32) (33) (34) (35) (36) (37) (38) (39)
- * (40) (41) (42) (43) (44) (45) (46) (47)
- * (48) (49) (50) (51) (52) (53) (54) (55)
- * (56) (57) (58) (59) (60) (61) (62) (63)
- */
-
-class Board {
-public:
-    typedef uint64_t data;
-
-public:
-    Board() : board_white(0x007E7E0000000000ULL), board_black(0x00000000007E7E00ULL) {}
-    Board(data black, data white) : board_white(white), board_black(black) {}
-    Board(const Board& b) = default;
-    Board& operator =(const Board& b) = default;
-    bool operator !=(const Board& b) {
-        return !((board_white == b.board_white) &&
-                 (board_black == b.board_black));
-    }
-
-    void set_black(data black)  { board_black = black; }
-    void set_white(data white)  { board_white = white; }
-
-    data& get_board(unsigned int i) {
-        return (i) ? board_white : board_black;
-    }
-    const data& get_board(unsigned int i) const {
-        return (i) ? board_white : board_black;
-    }
-
-    const bool game_over() const {
-        return !board_white || !board_black;
-    }
-
-public:
-    void get_possible_eat(std::vector<unsigned> &eats, int color) const {
-        Board::data mine = color ? board_white : board_black;
-        Board::data theirs = (color ^ 1) ? board_white : board_black;
-        Board::data occupied = mine | theirs | BORDER;
-        Board::data empty = ~occupied;
-
-        eats.clear();
-        for (auto &cc : CIRCLE) {
-            unsigned cc_cir[4][2] = {{ 0 }};
-            // choose the eater position (initial section in 1 of 4)
-            for (auto *i = &cc[21]; i != &cc[24]; i++) {
-                if (empty & (1ULL << *i)) continue;
-                // which square are eater and it's belonging (add the 7th bit, 1 mine or 0 theirs)
-                cc_cir[3][0] = *i | ((mine & (1ULL << *i)) >> (*i - 7));
-            }
-            for (unsigned j = 0; j < 4; j++) {
-                unsigned &old_eater = cc_cir[(j + 3) & 3][0]; // same as cc_cir[(j-1+4) % 4][0]
-                unsigned &eatee = cc_cir[j][1];
-                unsigned &eater = cc_cir[j][0];
-                for (auto *i = &cc[j * 6]; i != &cc[(j + 1) * 6]; i++) {
-                    if (empty & (1ULL << *i)) continue;
-                    eater = *i | ((mine & (1ULL << *i)) >> (*i - 7));
-                    // check the eatee and take the square at cross into consideration
-                    if (eatee == 0 && *i != (old_eater & 0b111111))
-                        eatee = eater;
-                }
-            }
-            // select eater
-            for (unsigned i = 0; i < 4; i++) {
-                if ((cc_cir[i][0] & (1 << 7)) == 0) continue; // only check if mine piece is eater
-                // select eatee
-                for (unsigned j = 1; j <= 4; j++) {
-                    unsigned row = (i + j) & 3;
-                    if(cc_cir[row][1] == 0) continue;     // the line is consider empty
-                    if(cc_cir[row][1] & (1 << 7)) break;  // the eatee is mine
-                    unsigned code = (cc_cir[i][0] & 0b111111) | ((cc_cir[row][1] & 0b111111) << 6);
-                    eats.push_back(code);
-                    break;
-                }
-            }
-        }
-    }
-
-    void get_possible_move(std::vector<unsigned> &moves, int color) const {
-        Board::data mine = color ? board_white : board_black;
-        Board::data theirs = (color ^ 1) ? board_white : board_black;
-        Board::data occupied = mine | theirs | BORDER;
-        Board::data empty = ~occupied;
-
-        moves.clear();
-        for (unsigned i = 9; i < 55; i++) {
-            if (!(mine & (1ULL << i)))   continue;
-            for (const unsigned &j : NEIGHBOR) {
-                if (empty & (1ULL << (i - j))) moves.push_back(((i - j) << 6) | i);
-                if (empty & (1ULL << (i + j))) moves.push_back(((i + j) << 6) | i);
-            }
-        }
-    }
-
-public:
-    int eat(unsigned origin, unsigned destination) {
-        board_white ^= 1ULL << destination;
-        board_black ^= 1ULL << destination;
-        board_white &= ~(1ULL << origin);
-        board_black &= ~(1ULL << origin);
-        return 1;
-    }
-
-    int move(unsigned origin, unsigned destination) {
-        board_white |= ((board_white >> origin) & 1) << destination;
-        board_black |= ((board_black >> origin) & 1) << destination;
-        board_white &= ~(1ULL << origin);
-        board_black &= ~(1ULL << origin);
-        return 1;
-    }
-
-public:
-    void rotate(int r = 1) {
-        switch (((r % 4) + 4) % 4) {
-            default:
-            case 0: break;
-            case 1: board_operation(1, 8); break; // rotate right
-            case 2: board_operation(9, 7); break; // reverse
-            case 3: board_operation(8, -1);break; // rotate left
-        }
-    }
-
-    void transpose() {
-        board_operation(0, 7);
-    }
-
-    //rotate then transpose
-    void rotate_tran(int r = 1) {
-        switch (((r % 4) + 4) % 4) {
-            default:
-            case 0: board_operation(0, 7); break; // same as transpose
-            case 1: board_operation(8, 8); break;
-            case 2: board_operation(9, 0); break;
-            case 3: board_operation(1, -1);break;
-        }
-    }
-
-protected:
-    /**
-     * Board Operation
-     *
-     * A.The whole 8*8 board could be devided into four 4*4 boards, 
-     *   and each of them contains four 2*2 boards. Show as below.
-     * 
-     *     (0)  (1) |  (2)  (3)  
-     *     (8)  (9) | (10) (11)    <- top-left 4*4 board
-     *    --------------------
-     *    (16) (17) | (18) (19)
-     *    (24) (25) | (26) (27)
-     * 
-     * B.The 8*8 board clockwise rotation could be seen as a total of the three actions below:
-     *    First, rotate the cells in every 2*2 board clockwise.
-     *       (8)  (0) | (10)  (2)  
-     *       (9)  (1) | (11)  (3)
-     *      --------------------
-     *      (24) (16) | (26) (18)
-     *      (25) (17) | (27) (19)
-     *
-     *    Second, move the position of four 2*2 clockwise in every 4*4 boards. 
-     *      (24) (16) |  (8)  (0)
-     *      (25) (17) |  (9)  (1)
-     *      --------------------
-     *      (26) (18) | (10)  (2)
-     *      (27) (19) | (11)  (3)
-     *
-     *    Last, move the four 4*4 clockwise in the 8*8 board
-     *      -The 4*4 above is now at top-right of the 8*8 board
-     * 
-     * C.On bitboard, the first action could be done by the union of four cells bit shifting.
-     *
-     * D.Furthermore, if we view a 2*2 as a cell, the second action is similar to the first with
-     *   two times the shifting digits at the corresponding position.As well as the third with 
-     *   4*4 taken. That is, the position of the cell (no matter it is a 1*1, 2*2, or 4*4) is the  
-     *   multiplicand of the digits to shift, while the size is the multiplier.
-     *
-     * E.The digits shift of four positions are required parameters. However, the cell diagonal
-     *   with will always be the same, so two parameters are enough.
-     *
-     * F.The operation of transposing, rotating several times, and the merge of them are similar.
-     *   So all of them can be done in the three actions (three bit-operations) with two parameters.
-     */
-
-    void board_operation(const int& a, const int& b) {
-        if (b >= 0) {
-            board_white = ((board_white &  F_LAYER       ) << a |
-                           (board_white & (F_LAYER <<  1)) << b |
-                           (board_white & (F_LAYER <<  8)) >> b |
-                           (board_white & (F_LAYER <<  9)) >> a);
-
-            board_white = ((board_white &  S_LAYER       ) << (a << 1) |
-                           (board_white & (S_LAYER <<  2)) << (b << 1) |
-                           (board_white & (S_LAYER << 16)) >> (b << 1) |
-                           (board_white & (S_LAYER << 18)) >> (a << 1));
-
-            board_white = ((board_white &  T_LAYER       ) << (a << 2) |
-                           (board_white & (T_LAYER <<  4)) << (b << 2) |
-                           (board_white & (T_LAYER << 32)) >> (b << 2) |
-                           (board_white & (T_LAYER << 36)) >> (a << 2));
-
-            board_black = ((board_black &  F_LAYER       ) << a |
-                           (board_black & (F_LAYER <<  1)) << b |
-                           (board_black & (F_LAYER <<  8)) >> b |
-                           (board_black & (F_LAYER <<  9)) >> a);
-
-            board_black = ((board_black &  S_LAYER       ) << (a << 1) |
-                           (board_black & (S_LAYER <<  2)) << (b << 1) |
-                           (board_black & (S_LAYER << 16)) >> (b << 1) |
-                           (board_black & (S_LAYER << 18)) >> (a << 1));
-
-            board_black = ((board_black &  T_LAYER       ) << (a << 2) |
-                           (board_black & (T_LAYER <<  4)) << (b << 2) |
-                           (board_black & (T_LAYER << 32)) >> (b << 2) |
-                           (board_black & (T_LAYER << 36)) >> (a << 2));
-        }
-        else {
-            board_white = ((board_white &  F_LAYER       ) <<  a |
-                           (board_white & (F_LAYER <<  1)) >> -b |
-                           (board_white & (F_LAYER <<  8)) << -b |
-                           (board_white & (F_LAYER <<  9)) >> a);
-
-            board_white = ((board_white &  S_LAYER       ) << ( a << 1) |
-                           (board_white & (S_LAYER <<  2)) >> (-b << 1) |
-                           (board_white & (S_LAYER << 16)) << (-b << 1) |
-                           (board_white & (S_LAYER << 18)) >> ( a << 1));
-
-            board_white = ((board_white &  T_LAYER       ) << ( a << 2) |
-                           (board_white & (T_LAYER <<  4)) >> (-b << 2) |
-                           (board_white & (T_LAYER << 32)) << (-b << 2) |
-                           (board_white & (T_LAYER << 36)) >> ( a << 2));
-
-            board_black = ((board_black &  F_LAYER       ) <<  a |
-                           (board_black & (F_LAYER <<  1)) >> -b |
-                           (board_black & (F_LAYER <<  8)) << -b |
-                           (board_black & (F_LAYER <<  9)) >> a);
-
-            board_black = ((board_black &  S_LAYER       ) << ( a << 1) |
-                           (board_black & (S_LAYER <<  2)) >> (-b << 1) |
-                           (board_black & (S_LAYER << 16)) << (-b << 1) |
-                           (board_black & (S_LAYER << 18)) >> ( a << 1));
-
-            board_black = ((board_black &  T_LAYER       ) << ( a << 2) |
-                           (board_black & (T_LAYER <<  4)) >> (-b << 2) |
-                           (board_black & (T_LAYER << 32)) << (-b << 2) |
-                           (board_black & (T_LAYER << 36)) >> ( a << 2));
-        }
-    }
-
-private:
-    data board_white;
-    data board_black;
-};
+#pragma once
+#include <array>
+#include <iostream>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "action.h"
+#include "movelist.h"
+#include "utilities.h"
+
+#define F_LAYER 0x0055005500550055ULL
+#define S_LAYER 0x0000333300003333ULL
+#define T_LAYER 0x000000000F0F0F0FULL
+#define BORDER  0xFF818181818181FFULL
+
+/**
+ * bitboard for Surakarta
+ *  (0)  (1)  (2)  (3)  (4)  (5)  (6)  (7)
+ *  (8)  (9) (10) (11) (12) (13) (14) (15)
+ * (16) (17) (18) (19) (20) (21) (22) (23)
+ * (24) (25) (26) (27) (28) (29) (30) (31)
+ * (32) (33) (34) (35) (36) (37) (38) (39)
+ * (40) (41) (42) (43) (44) (45) (46) (47)
+ * (48) (49) (50) (51) (52) (53) (54) (55)
+ * (56) (57) (58) (59) (60) (61) (62) (63)
+ */
+
+/**
+ * Ring tables for capture generation
+ *
+ * A.Every circle is made of four segments, and each segment is one of the eight lines
+ *   (row 2~5 or column 2~5) walked forward or backward. So the occupancy of a circle is
+ *   four 6-bit line words, reversed through a table when the segment walks backward.
+ *
+ * B.For capturing, only the last piece (the eater, which leaves the segment through the
+ *   arc) and the first piece (the eatee) of each segment matter. Two neighbouring segments
+ *   cross at one square, so the eater of the previous segment is skipped as an eatee.
+ *
+ * C.Each segment is summarized as (eater is mine) * 3 + (eatee is none/mine/theirs), and
+ *   the 6^4 summaries of a circle are mapped to the (eater, eatee) segment pairs.
+ */
+class RingTable {
+public:
+    struct circle {
+        unsigned line[4];       // 0~3 for row 2~5, 4~7 for column 2~5
+        bool reverse[4];        // the segment walks toward lower squares
+        unsigned square[4][7];  // square of each index in segment
+        unsigned cross_from;    // index of the cross square in the previous segment
+        unsigned cross_to;      // index of the cross square in this segment
+    };
+    struct capture {
+        unsigned count;
+        unsigned eater[4];
+        unsigned eatee[4];
+    };
+
+public:
+    RingTable() {
+        for (unsigned i = 0; i < 64; i++) {
+            rev6[i] = 0;
+            for (unsigned j = 0; j < 6; j++) rev6[i] |= ((i >> j) & 1) << (5 - j);
+            first[i] = i ? __builtin_ctz(i) : 6;
+            last[i] = i ? 31 - __builtin_clz(i) : 6;
+        }
+
+        for (unsigned c = 0; c < 4; c++) {
+            circle &cir = circles[c];
+            const unsigned *cc = CIRCLE[c];
+            for (unsigned s = 0; s < 4; s++) {
+                const unsigned *seg = &cc[s * 6];
+                bool is_row = (seg[0] >> 3) == (seg[1] >> 3);
+                cir.line[s] = is_row ? (seg[0] >> 3) - 2 : (seg[0] & 7) + 2;
+                cir.reverse[s] = seg[0] > seg[1];
+                for (unsigned i = 0; i < 6; i++) cir.square[s][i] = seg[i];
+                cir.square[s][6] = 0;
+            }
+            for (unsigned i = 0; i < 6; i++) {
+                for (unsigned j = 0; j < 6; j++) {
+                    if (cc[18 + i] != cc[j]) continue;
+                    cir.cross_from = i;
+                    cir.cross_to = j;
+                }
+            }
+        }
+
+        for (unsigned key = 0; key < 1296; key++) {
+            unsigned state[4];
+            for (unsigned s = 0, k = key; s < 4; s++, k /= 6) state[s] = k % 6;
+            capture &cap = captures[key];
+            cap.count = 0;
+            for (unsigned i = 0; i < 4; i++) {
+                if (state[i] < 3) continue; // only check if mine piece is eater
+                for (unsigned j = 1; j <= 4; j++) {
+                    unsigned row = (i + j) & 3;
+                    unsigned eatee = state[row] % 3;
+                    if (eatee == 0) continue;   // the line is consider empty
+                    if (eatee == 1) break;      // the eatee is mine
+                    cap.eater[cap.count] = i;
+                    cap.eatee[cap.count] = row;
+                    cap.count++;
+                    break;
+                }
+            }
+        }
+    }
+
+    // bit (i - 1) is square (r, i)
+    static unsigned row(uint64_t b, unsigned r) {
+        return (b >> (r * 8 + 1)) & 0b111111;
+    }
+    // bit (i - 1) is square (i, c)
+    static unsigned column(uint64_t b, unsigned c) {
+        return (((b >> c) & 0x0001010101010100ULL) * 0x0002040810204000ULL) >> 57;
+    }
+
+public:
+    circle circles[4];
+    capture captures[1296];
+    unsigned rev6[64];
+    unsigned first[64];
+    unsigned last[64];
+};
+
+static const RingTable ring_table;
+
+/**
+ * Zobrist keys, one random 64-bit key for each (color, square) and one for the side to move
+ *
+ * the keys are generated by splitmix64 with a fixed seed, so the hash of a position
+ * is the same across runs and processes
+ */
+class Zobrist {
+public:
+    Zobrist() {
+        uint64_t seed = 0x5572616B61727461ULL;
+        for (unsigned c = 0; c < 2; c++)
+            for (unsigned i = 0; i < 64; i++) piece[c][i] = splitmix64(seed);
+        side = splitmix64(seed);
+    }
+
+    uint64_t hash(uint64_t black, uint64_t white) const {
+        return hash_color(black, 0) ^ hash_color(white, 1);
+    }
+    uint64_t hash_color(uint64_t b, unsigned color) const {
+        uint64_t key = 0;
+        for (; b; b &= b - 1) key ^= piece[color][lsb_index(b)];
+        return key;
+    }
+
+private:
+    static uint64_t splitmix64(uint64_t &x) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+public:
+    uint64_t piece[2][64];
+    uint64_t side;
+};
+
+static const Zobrist zobrist;
+
+class Board {
+public:
+    typedef uint64_t data;
+
+public:
+    Board() : board_white(0x007E7E0000000000ULL), board_black(0x00000000007E7E00ULL) { rehash(); }
+    Board(data black, data white) : board_white(white), board_black(black) { rehash(); }
+    Board(const Board& b) = default;
+    Board& operator =(const Board& b) = default;
+    bool operator ==(const Board& b) const {
+        return (board_white == b.board_white) &&
+               (board_black == b.board_black);
+    }
+    bool operator !=(const Board& b) const { return !(*this == b); }
+
+    void set_black(data black)  { board_black = black; rehash(); }
+    void set_white(data white)  { board_white = white; rehash(); }
+
+    const data& get_board(unsigned int i) const {
+        return (i) ? board_white : board_black;
+    }
+
+    // zobrist key of the pieces, with the side to move if player is given
+    uint64_t get_hash() const { return hash; }
+    uint64_t get_hash(int player) const { return player ? hash ^ zobrist.side : hash; }
+
+    const bool game_over() const {
+        return !board_white || !board_black;
+    }
+
+public:
+    void get_possible_eat(MoveList &eats, int color) const {
+        eats.clear();
+        append_eat(eats, color);
+    }
+
+    void get_possible_move(MoveList &moves, int color) const {
+        moves.clear();
+        append_move(moves, color);
+    }
+
+    // number of quiet moves, for mobility
+    unsigned count_possible_move(int color) const {
+        Board::data mine = color ? board_white : board_black;
+        Board::data theirs = (color ^ 1) ? board_white : board_black;
+        Board::data empty = ~(mine | theirs | BORDER);
+
+        unsigned count = 0;
+        for (const unsigned &j : NEIGHBOR) {
+            count += Bitcount((mine >> j) & empty) + Bitcount((mine << j) & empty);
+        }
+        return count;
+    }
+
+    bool has_possible_eat(int color) const {
+        unsigned occ_line[8], mine_line[8];
+        ring_lines(color, occ_line, mine_line);
+
+        for (unsigned c = 0; c < 4; c++) {
+            unsigned last[4], first[4];
+            if (ring_table.captures[ring_key(c, occ_line, mine_line, last, first)].count) return true;
+        }
+        return false;
+    }
+
+    /**
+     * attack map of both colors, in one pass over the circles
+     *
+     * attackers[c]: pieces of color c which can capture
+     * attacked[c] : pieces of the other color which color c can capture
+     */
+    struct AttackMap {
+        data attackers[2];
+        data attacked[2];
+    };
+
+    AttackMap get_attack_map() const {
+        AttackMap map = { { 0, 0 }, { 0, 0 } };
+        unsigned occ_line[8], black_line[8];
+        ring_lines(0, occ_line, black_line);
+
+        for (unsigned c = 0; c < 4; c++) {
+            const RingTable::circle &cir = ring_table.circles[c];
+            unsigned last[4], first[4], key[2];
+            key[0] = ring_key(c, occ_line, black_line, last, first, &key[1]);
+            for (unsigned color = 0; color < 2; color++) {
+                const RingTable::capture &cap = ring_table.captures[key[color]];
+                for (unsigned k = 0; k < cap.count; k++) {
+                    const unsigned i = cap.eater[k], row = cap.eatee[k];
+                    map.attackers[color] |= 1ULL << cir.square[i][last[i]];
+                    map.attacked[color] |= 1ULL << cir.square[row][first[row]];
+                }
+            }
+        }
+        return map;
+    }
+
+    // the n-th quiet move in the order of get_possible_move, without generating the others
+    Action get_nth_move(int color, unsigned n) const {
+        Board::data mine = color ? board_white : board_black;
+        Board::data theirs = (color ^ 1) ? board_white : board_black;
+        Board::data empty = ~(mine | theirs | BORDER);
+
+        for (const unsigned &j : NEIGHBOR) {
+            Board::data dest = (mine >> j) & empty;
+            unsigned count = Bitcount(dest);
+            if (n < count) {
+                unsigned i = select_bit(dest, n);
+                return Action::Move(i + j, i);
+            }
+            n -= count;
+            dest = (mine << j) & empty;
+            count = Bitcount(dest);
+            if (n < count) {
+                unsigned i = select_bit(dest, n);
+                return Action::Move(i - j, i);
+            }
+            n -= count;
+        }
+        return Action();
+    }
+
+    /**
+     * uniformly random capture or quiet move, none if there is no such action
+     *
+     * the captures are counted from the capture table of each circle, then the chosen one
+     * is read from its entry, in the order of get_possible_eat
+     */
+    Action get_random_eat(int color, FastRandom &random) const {
+        unsigned occ_line[8], mine_line[8];
+        ring_lines(color, occ_line, mine_line);
+
+        unsigned last[4][4], first[4][4], count = 0;
+        const RingTable::capture* cap[4];
+        for (unsigned c = 0; c < 4; c++) {
+            cap[c] = &ring_table.captures[ring_key(c, occ_line, mine_line, last[c], first[c])];
+            count += cap[c]->count;
+        }
+        if (!count) return Action();
+
+        unsigned n = random.bounded(count), c = 0;
+        for (; n >= cap[c]->count; c++) n -= cap[c]->count;
+        const RingTable::circle &cir = ring_table.circles[c];
+        const unsigned i = cap[c]->eater[n], row = cap[c]->eatee[n];
+        return Action::Eat(cir.square[i][last[c][i]], cir.square[row][first[c][row]]);
+    }
+    Action get_random_move(int color, FastRandom &random) const {
+        unsigned count = count_possible_move(color);
+        return count ? get_nth_move(color, random.bounded(count)) : Action();
+    }
+
+    // captures first then the quiet moves, return the number of captures
+    unsigned get_possible_action(MoveList &actions, int color) const {
+        actions.clear();
+        append_eat(actions, color);
+        unsigned eat_count = actions.size();
+        append_move(actions, color);
+        return eat_count;
+    }
+
+private:
+    // occupancy of the eight lines the circles run on, in natural square order
+    void ring_lines(int color, unsigned (&occ_line)[8], unsigned (&mine_line)[8]) const {
+        Board::data mine = color ? board_white : board_black;
+        Board::data theirs = (color ^ 1) ? board_white : board_black;
+        Board::data occupied = mine | theirs;
+
+        for (unsigned i = 0; i < 4; i++) {
+            occ_line[i] = ring_table.row(occupied, i + 2);
+            mine_line[i] = ring_table.row(mine, i + 2);
+            occ_line[i + 4] = ring_table.column(occupied, i + 2);
+            mine_line[i + 4] = ring_table.column(mine, i + 2);
+        }
+    }
+
+    // summary key of circle c for the capture table, with the eater and eatee index of each segment,
+    // and the key for the opponent on the same circle if their_key is given
+    static unsigned ring_key(unsigned c, const unsigned (&occ_line)[8], const unsigned (&mine_line)[8],
+                             unsigned (&last)[4], unsigned (&first)[4], unsigned *their_key = nullptr) {
+        const RingTable::circle &cir = ring_table.circles[c];
+        unsigned occ[4], own[4];
+        for (unsigned s = 0; s < 4; s++) {
+            const unsigned line = cir.line[s];
+            occ[s] = cir.reverse[s] ? ring_table.rev6[occ_line[line]] : occ_line[line];
+            own[s] = cir.reverse[s] ? ring_table.rev6[mine_line[line]] : mine_line[line];
+            last[s] = ring_table.last[occ[s]];
+        }
+
+        // per segment: is the last piece (eater) mine, and is the first piece (eatee) none, mine or theirs
+        unsigned key = 0, their = 0;
+        for (unsigned s = 4; s-- > 0; ) {
+            unsigned eatee = occ[s];
+            // the first piece may be the eater of the previous segment passing the cross
+            if (last[(s + 3) & 3] == cir.cross_from) eatee &= ~(1u << cir.cross_to);
+            first[s] = ring_table.first[eatee];
+            unsigned state = ((own[s] >> last[s]) & 1) * 3;
+            if (eatee) state += ((own[s] >> first[s]) & 1) ? 1 : 2;
+            key = key * 6 + state;
+            if (their_key) {
+                // swap mine and theirs, an empty segment stays without eater
+                unsigned their_state = ((occ[s] & ~own[s]) >> last[s] & 1) * 3;
+                if (eatee) their_state += 3 - state % 3;
+                their = their * 6 + their_state;
+            }
+        }
+        if (their_key) *their_key = their;
+        return key;
+    }
+
+    void append_eat(MoveList &eats, int color) const {
+        unsigned occ_line[8], mine_line[8];
+        ring_lines(color, occ_line, mine_line);
+
+        for (unsigned c = 0; c < 4; c++) {
+            const RingTable::circle &cir = ring_table.circles[c];
+            unsigned last[4], first[4];
+            const RingTable::capture &cap = ring_table.captures[ring_key(c, occ_line, mine_line, last, first)];
+            for (unsigned k = 0; k < cap.count; k++) {
+                const unsigned i = cap.eater[k], row = cap.eatee[k];
+                eats.push_back(Action::Eat(cir.square[i][last[i]], cir.square[row][first[row]]));
+            }
+        }
+    }
+
+    /**
+     * shift all the pieces toward one of the 8 neighbors at once, the BORDER
+     * mask in empty squares drops the moves wrapping around the board
+     *
+     * the moves are ordered by direction (-1, +1, -7, +7, -8, +8, -9, +9),
+     * then by destination square
+     */
+    void append_move(MoveList &moves, int color) const {
+        Board::data mine = color ? board_white : board_black;
+        Board::data theirs = (color ^ 1) ? board_white : board_black;
+        Board::data occupied = mine | theirs | BORDER;
+        Board::data empty = ~occupied;
+
+        for (const unsigned &j : NEIGHBOR) {
+            for (Board::data dest = (mine >> j) & empty; dest; dest &= dest - 1) {
+                unsigned i = lsb_index(dest);
+                moves.push_back(Action::Move(i + j, i));
+            }
+            for (Board::data dest = (mine << j) & empty; dest; dest &= dest - 1) {
+                unsigned i = lsb_index(dest);
+                moves.push_back(Action::Move(i - j, i));
+            }
+        }
+    }
+
+public:
+    int eat(unsigned origin, unsigned destination) {
+        const data white = board_white, black = board_black;
+        board_white ^= 1ULL << destination;
+        board_black ^= 1ULL << destination;
+        board_white &= ~(1ULL << origin);
+        board_black &= ~(1ULL << origin);
+        hash ^= zobrist.hash(black ^ board_black, white ^ board_white);
+        return 1;
+    }
+
+    /**
+     * apply either kind of action without branching on it, the piece at origin
+     * lands on destination and whatever was on destination is cleared
+     */
+    int apply(Action action) {
+        const unsigned origin = action.origin(), destination = action.destination();
+        const data white = board_white, black = board_black;
+        const data clear = ~((1ULL << origin) | (1ULL << destination));
+        board_white = (white & clear) | (((white >> origin) & 1) << destination);
+        board_black = (black & clear) | (((black >> origin) & 1) << destination);
+        hash ^= zobrist.hash(black ^ board_black, white ^ board_white);
+        return 1;
+    }
+
+    int move(unsigned origin, unsigned destination) {
+        const data white = board_white, black = board_black;
+        board_white |= ((board_white >> origin) & 1) << destination;
+        board_black |= ((board_black >> origin) & 1) << destination;
+        board_white &= ~(1ULL << origin);
+        board_black &= ~(1ULL << origin);
+        hash ^= zobrist.hash(black ^ board_black, white ^ board_white);
+        return 1;
+    }
+
+public:
+    void rotate(int r = 1) {
+        switch (((r % 4) + 4) % 4) {
+            default:
+            case 0: break;
+            case 1: board_operation(1, 8); break; // rotate right
+            case 2: board_operation(9, 7); break; // reverse
+            case 3: board_operation(8, -1);break; // rotate left
+        }
+    }
+
+    void transpose() {
+        board_operation(0, 7);
+    }
+
+    //rotate then transpose
+    void rotate_tran(int r = 1) {
+        switch (((r % 4) + 4) % 4) {
+            default:
+            case 0: board_operation(0, 7); break; // same as transpose
+            case 1: board_operation(8, 8); break;
+            case 2: board_operation(9, 0); break;
+            case 3: board_operation(1, -1);break;
+        }
+    }
+
+    /**
+     * all the 8 images under rotation and transposition, in the order of
+     * rotating 0~3 times, then transposing and rotating 0~3 times
+     *
+     * the images are independent operations on the original board, so they are computed
+     * with both colors packed in SIMD lanes (two images per register with AVX2)
+     */
+    void get_symmetry(data (&blacks)[8], data (&whites)[8]) const {
+        symmetry(board_black, board_white, blacks, whites);
+    }
+
+    static void symmetry(data black, data white, data (&blacks)[8], data (&whites)[8]) {
+#if defined(__AVX2__)
+        for (unsigned i = 0; i < 8; i += 2) symmetry_pair(black, white, i, blacks, whites);
+#elif defined(__SSE2__)
+        const __m128i x = _mm_set_epi64x(white, black);
+        symmetry_one<SYMMETRY[0][0], SYMMETRY[0][1]>(x, 0, blacks, whites);
+        symmetry_one<SYMMETRY[1][0], SYMMETRY[1][1]>(x, 1, blacks, whites);
+        symmetry_one<SYMMETRY[2][0], SYMMETRY[2][1]>(x, 2, blacks, whites);
+        symmetry_one<SYMMETRY[3][0], SYMMETRY[3][1]>(x, 3, blacks, whites);
+        symmetry_one<SYMMETRY[4][0], SYMMETRY[4][1]>(x, 4, blacks, whites);
+        symmetry_one<SYMMETRY[5][0], SYMMETRY[5][1]>(x, 5, blacks, whites);
+        symmetry_one<SYMMETRY[6][0], SYMMETRY[6][1]>(x, 6, blacks, whites);
+        symmetry_one<SYMMETRY[7][0], SYMMETRY[7][1]>(x, 7, blacks, whites);
+#else
+        for (unsigned i = 0; i < 8; i++) {
+            blacks[i] = operation(black, SYMMETRY[i][0], SYMMETRY[i][1]);
+            whites[i] = operation(white, SYMMETRY[i][0], SYMMETRY[i][1]);
+        }
+#endif
+    }
+
+    // the minimum image of (black, white), same for all the symmetric boards
+    Board canonical() const {
+        data blacks[8], whites[8];
+        get_symmetry(blacks, whites);
+        unsigned best = 0;
+        for (unsigned i = 1; i < 8; i++) {
+            if (blacks[i] < blacks[best] || (blacks[i] == blacks[best] && whites[i] < whites[best])) best = i;
+        }
+        return Board(blacks[best], whites[best]);
+    }
+
+    // board operation parameters of each image, see get_symmetry
+    static constexpr int SYMMETRY[8][2] = { { 0, 0 }, { 1, 8 }, { 9, 7 }, { 8, -1 },
+                                            { 0, 7 }, { 1, -1 }, { 9, 0 }, { 8, 8 } };
+
+protected:
+    /**
+     * Board Operation
+     *
+     * A.The whole 8*8 board could be devided into four 4*4 boards, 
+     *   and each of them contains four 2*2 boards. Show as below.
+     * 
+     *     (0)  (1) |  (2)  (3)  
+     *     (8)  (9) | (10) (11)    <- top-left 4*4 board
+     *    --------------------
+     *    (16) (17) | (18) (19)
+     *    (24) (25) | (26) (27)
+     * 
+     * B.The 8*8 board clockwise rotation could be seen as a total of the three actions below:
+     *    First, rotate the cells in every 2*2 board clockwise.
+     *       (8)  (0) | (10)  (2)  
+     *       (9)  (1) | (11)  (3)
+     *      --------------------
+     *      (24) (16) | (26) (18)
+     *      (25) (17) | (27) (19)
+     *
+     *    Second, move the position of four 2*2 clockwise in every 4*4 boards. 
+     *      (24) (16) |  (8)  (0)
+     *      (25) (17) |  (9)  (1)
+     *      --------------------
+     *      (26) (18) | (10)  (2)
+     *      (27) (19) | (11)  (3)
+     *
+     *    Last, move the four 4*4 clockwise in the 8*8 board
+     *      -The 4*4 above is now at top-right of the 8*8 board
+     * 
+     * C.On bitboard, the first action could be done by the union of four cells bit shifting.
+     *
+     * D.Furthermore, if we view a 2*2 as a cell, the second action is similar to the first with
+     *   two times the shifting digits at the corresponding position.As well as the third with 
+     *   4*4 taken. That is, the position of the cell (no matter it is a 1*1, 2*2, or 4*4) is the  
+     *   multiplicand of the digits to shift, while the size is the multiplier.
+     *
+     * E.The digits shift of four positions are required parameters. However, the cell diagonal
+     *   with will always be the same, so two parameters are enough.
+     *
+     * F.The operation of transposing, rotating several times, and the merge of them are similar.
+     *   So all of them can be done in the three actions (three bit-operations) with two parameters.
+     */
+
+    void rehash() {
+        hash = zobrist.hash(board_black, board_white);
+    }
+
+    void board_operation(const int& a, const int& b) {
+        board_white = operation(board_white, a, b);
+        board_black = operation(board_black, a, b);
+        rehash();
+    }
+
+    static data operation(data x, const int& a, const int& b) {
+        if (b >= 0) {
+            x = ((x &  F_LAYER       ) << a |
+                 (x & (F_LAYER <<  1)) << b |
+                 (x & (F_LAYER <<  8)) >> b |
+                 (x & (F_LAYER <<  9)) >> a);
+
+            x = ((x &  S_LAYER       ) << (a << 1) |
+                 (x & (S_LAYER <<  2)) << (b << 1) |
+                 (x & (S_LAYER << 16)) >> (b << 1) |
+                 (x & (S_LAYER << 18)) >> (a << 1));
+
+            x = ((x &  T_LAYER       ) << (a << 2) |
+                 (x & (T_LAYER <<  4)) << (b << 2) |
+                 (x & (T_LAYER << 32)) >> (b << 2) |
+                 (x & (T_LAYER << 36)) >> (a << 2));
+        }
+        else {
+            x = ((x &  F_LAYER       ) <<  a |
+                 (x & (F_LAYER <<  1)) >> -b |
+                 (x & (F_LAYER <<  8)) << -b |
+                 (x & (F_LAYER <<  9)) >> a);
+
+            x = ((x &  S_LAYER       ) << ( a << 1) |
+                 (x & (S_LAYER <<  2)) >> (-b << 1) |
+                 (x & (S_LAYER << 16)) << (-b << 1) |
+                 (x & (S_LAYER << 18)) >> ( a << 1));
+
+            x = ((x &  T_LAYER       ) << ( a << 2) |
+                 (x & (T_LAYER <<  4)) >> (-b << 2) |
+                 (x & (T_LAYER << 32)) << (-b << 2) |
+                 (x & (T_LAYER << 36)) >> ( a << 2));
+        }
+        return x;
+    }
+
+#if defined(__AVX2__)
+    /**
+     * two images in one register, lanes are (black, white) of image i and (black, white) of image i + 1
+     *
+     * the shifts differ between the images, so they are variable shifts, and a negative b
+     * turns into a right shift after a zero left shift (or the other way round)
+     */
+    static __m256i layer(__m256i x, data m, int s, int t, __m256i a, __m256i l, __m256i r) {
+        const __m256i mask = _mm256_set1_epi64x(m);
+        __m256i t1 = _mm256_sllv_epi64(_mm256_and_si256(x, mask), a);
+        __m256i t2 = _mm256_srlv_epi64(_mm256_sllv_epi64(_mm256_and_si256(x, _mm256_set1_epi64x(m << s)), l), r);
+        __m256i t3 = _mm256_sllv_epi64(_mm256_srlv_epi64(_mm256_and_si256(x, _mm256_set1_epi64x(m << t)), l), r);
+        __m256i t4 = _mm256_srlv_epi64(_mm256_and_si256(x, _mm256_set1_epi64x(m << (s + t))), a);
+        return _mm256_or_si256(_mm256_or_si256(t1, t2), _mm256_or_si256(t3, t4));
+    }
+
+    static void symmetry_pair(data black, data white, unsigned i, data* blacks, data* whites) {
+        const int a0 = SYMMETRY[i][0], b0 = SYMMETRY[i][1];
+        const int a1 = SYMMETRY[i + 1][0], b1 = SYMMETRY[i + 1][1];
+        const int l0 = b0 >= 0 ? b0 : 0, r0 = b0 >= 0 ? 0 : -b0;
+        const int l1 = b1 >= 0 ? b1 : 0, r1 = b1 >= 0 ? 0 : -b1;
+        __m256i x = _mm256_set_epi64x(white, black, white, black);
+        for (int k = 0; k < 3; k++) {
+            const __m256i a = _mm256_set_epi64x(a1 << k, a1 << k, a0 << k, a0 << k);
+            const __m256i l = _mm256_set_epi64x(l1 << k, l1 << k, l0 << k, l0 << k);
+            const __m256i r = _mm256_set_epi64x(r1 << k, r1 << k, r0 << k, r0 << k);
+            switch (k) {
+                case 0: x = layer(x, F_LAYER, 1,  8, a, l, r); break;
+                case 1: x = layer(x, S_LAYER, 2, 16, a, l, r); break;
+                case 2: x = layer(x, T_LAYER, 4, 32, a, l, r); break;
+            }
+        }
+        alignas(32) data out[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out), x);
+        blacks[i] = out[0]; whites[i] = out[1];
+        blacks[i + 1] = out[2]; whites[i + 1] = out[3];
+    }
+#elif defined(__SSE2__)
+    // one image in one register, lanes are (black, white)
+    template<int a, int l, int r, int s, int t>
+    static __m128i layer(__m128i x, data m) {
+        __m128i t1 = _mm_slli_epi64(_mm_and_si128(x, _mm_set1_epi64x(m)), a);
+        __m128i t2 = _mm_srli_epi64(_mm_slli_epi64(_mm_and_si128(x, _mm_set1_epi64x(m << s)), l), r);
+        __m128i t3 = _mm_slli_epi64(_mm_srli_epi64(_mm_and_si128(x, _mm_set1_epi64x(m << t)), l), r);
+        __m128i t4 = _mm_srli_epi64(_mm_and_si128(x, _mm_set1_epi64x(m << (s + t))), a);
+        return _mm_or_si128(_mm_or_si128(t1, t2), _mm_or_si128(t3, t4));
+    }
+
+    template<int a, int b>
+    static void symmetry_one(__m128i x, unsigned i, data* blacks, data* whites) {
+        const int l = b >= 0 ? b : 0, r = b >= 0 ? 0 : -b;
+        x = layer<a, l, r, 1, 8>(x, F_LAYER);
+        x = layer<(a << 1), (l << 1), (r << 1), 2, 16>(x, S_LAYER);
+        x = layer<(a << 2), (l << 2), (r << 2), 4, 32>(x, T_LAYER);
+        blacks[i] = _mm_cvtsi128_si64(x);
+        whites[i] = _mm_cvtsi128_si64(_mm_unpackhi_epi64(x, x));
+    }
+#endif
+
+private:
+    data board_white;
+    data board_black;
+    uint64_t hash;
+};
+
+constexpr int Board::SYMMETRY[8][2];
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <sstream>
+#include <string>
+#include "tree.h"
+
+/**
+ * when a search stops: after its simulations, at the deadline of the move, once the best
+ * child of the root cannot be caught up with, or when cancelled from another thread
+ *
+ * the deadline is the time of a move (set_move_time), or the share of a game clock the
+ * allocation policy gives it (set_clock), whichever comes first; the clock is kept here,
+ * each search takes its time off it and adds the increment
+ *
+ * by default a search runs its simulations, as deterministic as before
+ *
+ * a search on the opponent's time (pondering) has neither deadline nor early stop, and
+ * does not take from the clock; it runs until cancelled, or ponder_factor times the
+ * simulations, for the memory of the tree
+ *
+ * the search threads only call stop(), the rest is for the thread that owns the search
+ */
+class Budget {
+public:
+    enum reason { NONE, SIMULATIONS, DEADLINE, DECIDED, CANCELLED };
+
+    Budget(int simulations = 5000) : simulations(simulations), move_ms(0), clock_ms(-1), increment_ms(0),
+        moves_to_go(20), early_stop(false), cancelled(false), stopped(NONE), pondering(false), limit(simulations),
+        started_at(0), allotted_ms(0),
+        last_simulations(0), last_ms(0), last_reason(NONE) {}
+
+    void set_simulations(int simulations) { this->simulations = simulations; }
+    int get_simulations() const { return simulations; }
+    // the most simulations of the search started last
+    int get_limit() const { return limit; }
+    // the most milliseconds a move takes, 0 for no limit
+    void set_move_time(int64_t ms) { move_ms = std::max<int64_t>(ms, 0); }
+    // milliseconds left on the game clock, with the increment each move earns, -1 for no clock
+    void set_clock(int64_t remaining_ms, int64_t increment_ms = 0) {
+        clock_ms = remaining_ms;
+        this->increment_ms = std::max<int64_t>(increment_ms, 0);
+    }
+    int64_t get_clock() const { return clock_ms; }
+    // the moves the rest of the clock is shared by, see allot
+    void set_moves_to_go(int moves) { moves_to_go = std::max(moves, 1); }
+    // stop once the most visited child of the root keeps its lead whatever the rest do
+    void set_early_stop(bool early_stop) { this->early_stop = early_stop; }
+
+    // stop the current search, or the next one if none runs, from any thread; cancel(false)
+    // takes back a cancel no search has seen
+    void cancel(bool stop = true) { cancelled.store(stop, std::memory_order_relaxed); }
+
+    /**
+     * the milliseconds of the next move on the clock: an equal share of what is left for
+     * moves_to_go moves, plus the increment, never more than half of what is left
+     */
+    int64_t allot() const {
+        if (clock_ms < 0) return 0;
+        const int64_t share = clock_ms / moves_to_go + increment_ms;
+        return std::max<int64_t>(std::min(share, clock_ms / 2), 1);
+    }
+
+    // the search starts, with done simulations of the tree kept from the last one
+    void start(int done, bool pondering = false) {
+        this->pondering = pondering;
+        limit = pondering ? int(std::min<int64_t>(int64_t(simulations) * ponder_factor, INT_MAX)) : simulations;
+        allotted_ms = pondering ? 0 : allot();
+        if (move_ms > 0 && !pondering) allotted_ms = allotted_ms ? std::min(allotted_ms, move_ms) : move_ms;
+        started_at = done;
+        stopped.store(NONE, std::memory_order_relaxed);
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * whether the search stops before simulation done, the number of simulations taken so far
+     * (with those of the tree kept from the last search); at least one is run, so that the
+     * root has its children
+     */
+    bool stop(int done, const Tree &tree) {
+        if (done <= started_at) return false; // before any other reason, even a tree kept with enough visits
+        if (stopped.load(std::memory_order_relaxed) != NONE) return true;
+        if (done >= limit) return halt(SIMULATIONS);
+        if (cancelled.load(std::memory_order_relaxed)) return halt(CANCELLED);
+        if (!allotted_ms && !(early_stop && !pondering)) return false;
+
+        const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+        if (allotted_ms && elapsed >= allotted_ms) return halt(DEADLINE);
+        if (!early_stop || pondering || done % check_every) return false;
+
+        // the simulations still to come, by the budget and by the rate so far in the time left
+        int64_t left = simulations - done;
+        if (allotted_ms) left = std::min<int64_t>(left, int64_t((done - started_at) * (allotted_ms - elapsed) / std::max(elapsed, 1.0)) + 1);
+        int best = 0, second = 0;
+        const Tree::stats* child = tree.child_stats(tree.root());
+        for (unsigned i = 0; i < tree.child_count(tree.root()); i++) {
+            const int visits = child[i].visit_count.load(std::memory_order_relaxed);
+            if (visits > best) second = best, best = visits;
+            else if (visits > second) second = visits;
+        }
+        return tree.child_count(tree.root()) && best - second > left ? halt(DECIDED) : false;
+    }
+
+    // the search is over after done simulations, elapsed milliseconds go off the clock
+    void finish(int done) {
+        const int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+        if (clock_ms >= 0 && !pondering) clock_ms = std::max<int64_t>(clock_ms - elapsed, 0) + increment_ms;
+        last_simulations = done - started_at;
+        last_ms = elapsed;
+        last_reason = reason(stopped.load(std::memory_order_relaxed));
+        if (last_reason == NONE) last_reason = SIMULATIONS;
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    reason get_reason() const { return last_reason; }
+    std::string stats() const {
+        static const char* name[] = { "none", "simulations", "deadline", "decided", "cancelled" };
+        std::stringstream ss;
+        ss << last_simulations << " simulations in " << last_ms << " ms (" << name[last_reason];
+        if (pondering) ss << ", pondering";
+        if (allotted_ms) ss << ", " << allotted_ms << " ms allotted";
+        if (clock_ms >= 0) ss << ", " << clock_ms << " ms left";
+        ss << ")";
+        return ss.str();
+    }
+
+private:
+    static const int check_every = 64; // simulations between two looks at the lead
+    static const int ponder_factor = 4;
+
+    bool halt(reason why) {
+        int expected = NONE;
+        stopped.compare_exchange_strong(expected, why, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    int simulations;
+    int64_t move_ms, clock_ms, increment_ms;
+    int moves_to_go;
+    bool early_stop;
+    std::atomic<bool> cancelled;
+
+    // the search under way
+    std::atomic<int> stopped;
+    bool pondering;
+    int limit;
+    int started_at;
+    int64_t allotted_ms;
+    std::chrono::steady_clock::time_point start_time;
+
+    // the last search
+    int last_simulations;
+    int64_t last_ms;
+    reason last_reason;
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include "region.h"
+
+/**
+ * lock-free set-associative cache of position values, shared by all search threads
+ *
+ * each bucket is one cache line of 4 entries, an entry holds the data (value and the low
+ * half of the version) and the key xor the data xor the whole version, so a torn write of
+ * an entry never matches its key
+ *
+ * the version changes whenever the weights are trained, which drops every entry at once;
+ * it is 64 bits and checked whole, so it never wraps back to an old entry
+ */
+class EvalCache {
+public:
+    EvalCache(size_t megabytes = 0, uint64_t version = 1) : table(nullptr), mask(0), version(version), lookups(0), hits(0) {
+        resize(megabytes);
+    }
+
+    // 0 disables the cache, otherwise the largest power of two buckets that fits
+    void resize(size_t megabytes) {
+        size_t buckets = 1;
+        while (buckets * 2 * sizeof(bucket) <= (megabytes << 20)) buckets *= 2;
+        memory = Region::allocate(megabytes ? buckets * sizeof(bucket) : 0);
+        table = reinterpret_cast<bucket*>(memory->data());
+        for (size_t i = 0; table && i < buckets; i++) new (&table[i]) bucket();
+        mask = table ? buckets - 1 : 0;
+        lookups = hits = 0;
+    }
+
+    bool enabled() const { return table != nullptr; }
+    size_t bytes() const { return table ? (mask + 1) * sizeof(bucket) : 0; }
+
+    // the splitmix64 finalizer, to build keys
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // after the weights change, so that a value computed before it is never stored as a new one
+    void invalidate() { version.fetch_add(1, std::memory_order_release); }
+    // the version to store a value with, taken before the value is computed
+    uint64_t current() const { return version.load(std::memory_order_acquire); }
+
+    void prefetch(uint64_t key) const { __builtin_prefetch(&table[key & mask]); }
+
+    bool probe(uint64_t key, float &value) const {
+        const bucket& b = table[key & mask];
+        const uint64_t current = version.load(std::memory_order_relaxed);
+        for (const entry& e : b.entries) {
+            const uint64_t data = e.data.load(std::memory_order_relaxed);
+            if ((e.check.load(std::memory_order_relaxed) ^ data ^ current) == key && uint32_t(data >> 32) == uint32_t(current)) {
+                const uint32_t bits = uint32_t(data);
+                std::memcpy(&value, &bits, sizeof(value));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * replace a stale entry if any, otherwise the one picked by the key; a value of an older
+     * version than the current one is dropped, the weights changed while it was computed
+     */
+    void store(uint64_t key, float value, uint64_t computed) {
+        bucket& b = table[key & mask];
+        const uint64_t current = version.load(std::memory_order_relaxed);
+        if (computed != current) return;
+        entry* slot = &b.entries[(key >> 62) & 3];
+        for (entry& e : b.entries) {
+            if (uint32_t(e.data.load(std::memory_order_relaxed) >> 32) != uint32_t(current)) {
+                slot = &e;
+                break;
+            }
+        }
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint64_t data = (uint64_t(current) << 32) | bits;
+        slot->check.store(key ^ data ^ current, std::memory_order_relaxed);
+        slot->data.store(data, std::memory_order_relaxed);
+    }
+
+    // counted by the callers once per call, to keep the shared counters off the hot path
+    void count(uint64_t lookup, uint64_t hit) {
+        lookups.fetch_add(lookup, std::memory_order_relaxed);
+        hits.fetch_add(hit, std::memory_order_relaxed);
+    }
+
+    std::string stats() const {
+        std::stringstream ss;
+        const uint64_t n = lookups.load(), h = hits.load();
+        ss << (bytes() >> 20) << " MB, " << h << " hits / " << n << " lookups";
+        if (n) ss << " (" << int(h * 1000 / n) / 10.0 << " %)";
+        return ss.str();
+    }
+
+private:
+    struct entry {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+        entry() : check(0), data(0) {}
+    };
+    struct alignas(64) bucket {
+        entry entries[4];
+    };
+
+    std::shared_ptr<Region> memory;
+    bucket* table;
+    size_t mask;
+    std::atomic<uint64_t> version;
+    std::atomic<uint64_t> lookups, hits;
+};
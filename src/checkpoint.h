@@ -0,0 +1,455 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "region.h"
+#include "utilities.h"
+#include "weight.h"
+
+/**
+ * checkpoints of the weight tables to a file, written by a background thread
+ *
+ * the first checkpoints write the whole file (the base), a slice of the tables each, the
+ * next ones append the chunks changed since the previous one to path.delta, and every few
+ * checkpoints the writer compacts the deltas into a new base; the latest weights are the
+ * base plus the deltas, which Tuple::load_weights replays
+ *
+ * a checkpoint can also leave the compacted weights in a snapshot file of its own, a plain
+ * weight file the next checkpoints do not touch; one asked for while the writer is busy,
+ * or before the base is complete, is taken by the next checkpoint that can
+ *
+ * the training thread only copies the dirty chunks (see Weight::mark), or a slice of the
+ * base, the writer does the I/O; a checkpoint while the writer is busy is skipped and its
+ * chunks stay dirty; the last slice of a base brings along the chunks changed since their
+ * own slice was copied, so that the base holds the tables as of that checkpoint
+ *
+ * a base is written aside and renamed over path, and a delta counts once its end marker
+ * is written, so a crash at any point leaves the previous checkpoint (see replace)
+ *
+ * in path.delta, each checkpoint is begin_mark and the number of chunks as uint32, then
+ * each chunk as its table and number as uint32 and its bytes, then end_mark as uint32
+ */
+class Checkpoint {
+public:
+    Checkpoint(const std::string& path, unsigned compact = 8, size_t slice = size_t(64) << 20) : path(path),
+        compact_every(std::max(1u, compact)), slice_bytes(std::max(slice, size_t(chunk_bytes))),
+        busy(false), stop(false), need_base(true), base_table(0), base_chunk(0),
+        last_deltas(0), last_delta_bytes(0), last_base_bytes(0), written(0), skipped(0),
+        deltas(0), delta_bytes(0), base_bytes(0), file_bytes(0), writer(&Checkpoint::run, this) { recover(path); }
+    ~Checkpoint() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        ready.notify_all();
+        writer.join();
+    }
+
+    const std::string& get_path() const { return path; }
+
+    /**
+     * copy the chunks of tables changed since the last checkpoint and hand them to the
+     * writer, or the next slice of a new base; header is what the file holds before the tables
+     *
+     * with a snapshot path, the deltas are compacted and the base is linked there too, now
+     * or by a later checkpoint
+     *
+     * return false if the writer is still busy with the previous checkpoint
+     */
+    bool save(const std::string& header, std::vector<Weight>& tables, bool compact = false, const std::string& snapshot = "") {
+        return save(header, tables, compact, snapshot, slice_bytes);
+    }
+
+    // block until the writer is idle
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return !busy; });
+    }
+
+    // a last checkpoint compacted into a plain weight file, blocking, for the end of training
+    void finish(const std::string& header, std::vector<Weight>& tables) {
+        wait();
+        save(header, tables, true, "", SIZE_MAX); // the rest of the base at once
+        wait();
+    }
+
+    std::string stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::stringstream ss;
+        ss << written << " checkpoints (" << skipped << " skipped), " << last_deltas << " deltas of "
+           << (last_delta_bytes >> 10) << " kB on a base of " << (last_base_bytes >> 20) << " MB; " << last;
+        return ss.str();
+    }
+
+    /**
+     * replay the deltas of the checkpoint at path into tables loaded from its base,
+     * return the number of checkpoints replayed
+     */
+    static size_t replay(const std::string& path, std::vector<Weight>& tables) {
+        std::vector<size_t> sizes;
+        for (const Weight& w : tables) sizes.push_back(w.bytes());
+        return replay(path, sizes, [&](size_t t, size_t offset, const char* data, size_t length) {
+            std::memcpy(tables[t].data<char>() + offset, data, length);
+            return true;
+        });
+    }
+
+    /**
+     * rename temp, a new base written from the tables, over path, without the deltas of the
+     * old base; they are renamed aside first and removed last, see recover
+     */
+    static bool replace(const std::string& temp, const std::string& path) {
+        const std::string delta = path + ".delta", old = path + ".delta.old";
+        if (std::rename(delta.c_str(), old.c_str()) != 0 && errno != ENOENT) return false;
+        if (std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::rename(old.c_str(), delta.c_str());
+            return false;
+        }
+        std::remove(old.c_str());
+        return true;
+    }
+
+    /**
+     * finish a replace cut short by a crash: with temp still there, path is the old base and
+     * the deltas aside are still its own, otherwise they belong to the base replaced
+     */
+    static void recover(const std::string& path) {
+        const std::string delta = path + ".delta", old = path + ".delta.old", temp = path + ".tmp";
+        struct stat st;
+        if (stat(old.c_str(), &st) != 0) return;
+        if (stat(temp.c_str(), &st) == 0) {
+            std::rename(old.c_str(), delta.c_str());
+            std::remove(temp.c_str());
+        }
+        else std::remove(old.c_str());
+    }
+
+    static bool pending(const std::string& path) {
+        struct stat st;
+        return stat((path + ".delta").c_str(), &st) == 0 && st.st_size > 0;
+    }
+
+private:
+    static const uint32_t begin_mark = 0x444B5053; // "SPKD"
+    static const uint32_t end_mark = 0x454B5053;   // "SPKE"
+    static const size_t chunk_bytes = Weight::chunk_bytes;
+
+    struct job {
+        bool full = false, first = false, last = false, compact = false;
+        std::string header;
+        std::vector<std::string> prefix, snapshots;
+        std::vector<size_t> sizes;
+        std::vector<char> data; // the chunks of a delta or of a slice of the base, with their place
+        size_t chunks = 0;
+        double copy_ms = 0;
+    };
+
+    // a checkpoint of at most slice bytes of the base
+    bool save(const std::string& header, std::vector<Weight>& tables, bool compact, const std::string& snapshot, size_t slice) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!snapshot.empty()) waiting.push_back(snapshot);
+        if (busy) {
+            skipped++;
+            return false;
+        }
+        const bool full = need_base;
+        size_t table = base_table, chunk = base_chunk;
+        lock.unlock(); // the writer is idle until busy is set
+
+        const auto start = std::chrono::steady_clock::now();
+        work = job();
+        work.full = full;
+        work.first = full && table == 0 && chunk == 0;
+        work.header = header;
+        for (const Weight& w : tables) {
+            work.prefix.push_back(w.prefix());
+            work.sizes.push_back(w.bytes());
+        }
+        auto copy = [&](size_t t, size_t c) {
+            const char* raw = tables[t].data<char>() + c * chunk_bytes;
+            const size_t length = std::min(tables[t].bytes() - c * chunk_bytes, size_t(chunk_bytes));
+            const uint32_t where[] = { uint32_t(t), uint32_t(c) };
+            work.data.insert(work.data.end(), reinterpret_cast<const char*>(where), reinterpret_cast<const char*>(where + 2));
+            work.data.insert(work.data.end(), raw, raw + length);
+            work.chunks++;
+        };
+        if (full) {
+            size_t bytes = 0;
+            for (const Weight& w : tables) bytes += w.bytes();
+            work.data.reserve(std::min(slice, bytes) / chunk_bytes * (chunk_bytes + 8) + chunk_bytes + 8);
+            auto skip = [&] { while (table < tables.size() && chunk == tables[table].chunks()) table++, chunk = 0; };
+            const size_t from_table = table, from_chunk = chunk;
+            for (skip(); table < tables.size() && work.data.size() < slice; skip()) {
+                tables[table].take(chunk);
+                copy(table, chunk++);
+            }
+            // with the chunks changed since their slice, the base is the tables as they are now
+            work.last = table == tables.size();
+            for (size_t t = 0; work.last && t <= from_table && t < tables.size(); t++)
+                for (size_t c = 0; c < (t < from_table ? tables[t].chunks() : from_chunk); c++)
+                    if (tables[t].take(c)) copy(t, c);
+        }
+        else {
+            for (size_t t = 0; t < tables.size(); t++)
+                for (size_t c = 0; c < tables[t].chunks(); c++)
+                    if (tables[t].take(c)) copy(t, c);
+        }
+        work.copy_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        base_table = table, base_chunk = chunk;
+        if (!full || work.last) work.snapshots.swap(waiting);
+        work.compact = compact || !work.snapshots.empty();
+        busy = true;
+        ready.notify_all();
+        return true;
+    }
+
+    // each complete checkpoint of path.delta in order, apply returns false to stop
+    static size_t replay(const std::string& path, const std::vector<size_t>& sizes,
+                         const std::function<bool(size_t, size_t, const char*, size_t)>& apply) {
+        if (!pending(path)) return 0;
+        std::shared_ptr<Region> file = Region::map(path + ".delta", Region::SHARED);
+        if (!file) return 0;
+        const char* const data = file->data();
+        const size_t size = file->size();
+        size_t offset = 0, count = 0;
+        auto word = [&](size_t at) {
+            uint32_t w;
+            std::memcpy(&w, data + at, sizeof(w));
+            return w;
+        };
+
+        while (offset + 8 <= size && word(offset) == begin_mark) {
+            // check the whole checkpoint before applying any of it
+            const uint32_t chunks = word(offset + 4);
+            size_t end = offset + 8;
+            bool valid = true;
+            for (uint32_t i = 0; valid && i < chunks; i++) {
+                valid = end + 8 <= size && word(end) < sizes.size() && word(end + 4) * chunk_bytes < sizes[word(end)];
+                if (valid) end += 8 + std::min(sizes[word(end)] - word(end + 4) * chunk_bytes, size_t(chunk_bytes));
+            }
+            if (!valid || end + 4 > size || word(end) != end_mark) break;
+
+            for (size_t at = offset + 8, i = 0; i < chunks; i++) {
+                const size_t t = word(at), from = word(at + 4) * chunk_bytes;
+                const size_t length = std::min(sizes[t] - from, size_t(chunk_bytes));
+                if (!apply(t, from, data + at + 8, length)) return count;
+                at += 8 + length;
+            }
+            offset = end + 4;
+            count++;
+        }
+        return count;
+    }
+
+    void run() {
+        unpin_thread(); // off the cpu of a pinned training thread
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [this] { return busy || stop; });
+            if (!busy) return;
+            lock.unlock();
+
+            const auto start = std::chrono::steady_clock::now();
+            const bool ok = work.full ? write_base() : write_delta();
+            if (!ok) std::cerr << "checkpoint to " << path << " failed: " << std::strerror(errno) << std::endl;
+            // a failed compaction leaves the base and the deltas as they were, to try again
+            const bool complete = ok && (!work.full || work.last);
+            bool compacted = work.full;
+            if (ok && !work.full && (work.compact || deltas >= compact_every || delta_bytes > base_bytes / 2)) {
+                compacted = compact();
+                if (!compacted) std::cerr << "compaction of " << path << " failed: " << std::strerror(errno) << std::endl;
+            }
+            // a snapshot that failed is taken again by the next checkpoint
+            std::vector<std::string> missed;
+            for (const std::string& to : work.snapshots) {
+                if (complete && compacted && snapshot(to)) continue;
+                std::cerr << "snapshot to " << to << " failed: " << std::strerror(errno) << std::endl;
+                missed.push_back(to);
+            }
+            std::stringstream ss;
+            ss << "last " << (work.full ? work.last ? "base" : "slice of the base" : "delta") << " of " << work.chunks
+               << " chunks, copied in " << int(work.copy_ms) << " ms, written in "
+               << int(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) << " ms";
+            const bool base_done = complete && work.full;
+            work = job();
+
+            lock.lock();
+            last = ss.str();
+            last_deltas = deltas, last_delta_bytes = delta_bytes, last_base_bytes = base_bytes;
+            written += complete;
+            waiting.insert(waiting.begin(), missed.begin(), missed.end());
+            if (!ok) { // the chunks of a failed checkpoint are no longer dirty, and a slice of the base is lost
+                need_base = true;
+                base_table = base_chunk = 0;
+            }
+            else if (base_done) need_base = false;
+            busy = false;
+            done.notify_all();
+        }
+    }
+
+    static bool write_all(int fd, const char* data, size_t length) {
+        while (length) {
+            const ssize_t n = ::write(fd, data, length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    static bool write_at(int fd, const char* data, size_t length, size_t offset) {
+        while (length) {
+            const ssize_t n = ::pwrite(fd, data, length, offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            offset += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    /**
+     * a slice of the base in its place of the file aside, which the first slice lays out;
+     * after the last one it replaces the old base and its deltas
+     */
+    bool write_base() {
+        const std::string temp = path + ".tmp";
+        const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | (work.first ? O_TRUNC : 0), 0644);
+        if (fd < 0) return false;
+        bool ok = true;
+        if (work.first) {
+            ok = write_at(fd, work.header.data(), work.header.size(), 0);
+            size_t offset = work.header.size();
+            offsets.clear();
+            for (size_t t = 0; ok && t < work.sizes.size(); t++) {
+                ok = write_at(fd, work.prefix[t].data(), work.prefix[t].size(), offset);
+                offset += work.prefix[t].size();
+                offsets.push_back(offset);
+                offset += work.sizes[t];
+            }
+            ok = ok && ftruncate(fd, offset) == 0;
+            file_bytes = offset;
+        }
+        for (size_t at = 0; ok && at < work.data.size(); ) {
+            uint32_t where[2];
+            std::memcpy(where, work.data.data() + at, sizeof(where));
+            const size_t length = std::min(work.sizes[where[0]] - where[1] * chunk_bytes, size_t(chunk_bytes));
+            ok = write_at(fd, work.data.data() + at + sizeof(where), length, offsets[where[0]] + where[1] * chunk_bytes);
+            at += sizeof(where) + length;
+        }
+        ok = ok && (!work.last || fsync(fd) == 0);
+        ok = close(fd) == 0 && ok;
+        if (!ok || (work.last && !replace(temp, path))) {
+            std::remove(temp.c_str());
+            return false;
+        }
+        if (!work.last) return true;
+        sizes = work.sizes;
+        base_bytes = file_bytes;
+        deltas = delta_bytes = 0;
+        return true;
+    }
+
+    bool write_delta() {
+        if (work.chunks == 0) return true;
+        const int fd = open((path + ".delta").c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) return false;
+        // a torn checkpoint is skipped by replay, but it would hide the ones appended after it
+        bool ok = ftruncate(fd, delta_bytes) == 0 && lseek(fd, delta_bytes, SEEK_SET) == off_t(delta_bytes);
+        const uint32_t begin[] = { begin_mark, uint32_t(work.chunks) }, end = end_mark;
+        ok = ok && write_all(fd, reinterpret_cast<const char*>(begin), sizeof(begin));
+        ok = ok && write_all(fd, work.data.data(), work.data.size());
+        ok = ok && write_all(fd, reinterpret_cast<const char*>(&end), sizeof(end));
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok) return false;
+        deltas++;
+        delta_bytes += sizeof(begin) + work.data.size() + sizeof(end);
+        return true;
+    }
+
+    /**
+     * a copy of the base with the deltas replayed into it replaces the base, then the deltas
+     * go; a crash in between replays them again on the new base, which changes nothing
+     */
+    bool compact() {
+        if (deltas == 0) return true;
+        std::shared_ptr<Region> base = Region::map(path, Region::SHARED);
+        if (!base) return false;
+        const std::string temp = path + ".tmp";
+        const int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        bool ok = write_all(fd, base->data(), base->size());
+        base.reset();
+        ok = ok && replay(path, sizes, [&](size_t t, size_t offset, const char* data, size_t length) {
+            return pwrite(fd, data, length, offsets[t] + offset) == ssize_t(length);
+        }) == deltas;
+        ok = ok && fsync(fd) == 0;
+        ok = close(fd) == 0 && ok;
+        if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+        std::remove((path + ".delta").c_str());
+        deltas = delta_bytes = 0;
+        return true;
+    }
+
+    /**
+     * a hard link of the base at to, which stays as it is: a base is only ever replaced by
+     * a rename, never written in place
+     */
+    bool snapshot(const std::string& to) {
+        const std::string temp = to + ".tmp";
+        std::remove(temp.c_str());
+        std::remove((to + ".delta").c_str());
+        if (link(path.c_str(), temp.c_str()) != 0) return false;
+        if (std::rename(temp.c_str(), to.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+private:
+    const std::string path;
+    const unsigned compact_every;
+    const size_t slice_bytes; // of the base, copied by one checkpoint
+
+    // the state of the writer, shared under mutex
+    mutable std::mutex mutex;
+    std::condition_variable ready, done;
+    bool busy, stop, need_base;
+    size_t base_table, base_chunk; // the next chunk of a base to copy
+    std::vector<std::string> waiting; // the snapshots to take
+    job work;
+    std::string last;
+    size_t last_deltas, last_delta_bytes, last_base_bytes; // the files as of the last checkpoint
+    size_t written, skipped;
+
+    // the base as last written, known to the writer only
+    std::vector<size_t> offsets, sizes;
+    size_t deltas, delta_bytes, base_bytes, file_bytes;
+
+    std::thread writer;
+};
@@ -29,8 +29,8 @@ public:
     }
 
     bool apply_action(Action move) {
-        int result = move.apply(state());
-        if (result == -1)   return false;
+        if (move.is_none())   return false;
+        state().apply(move);
         ep_moves.emplace_back(move, millisec() - ep_time);
         return true;
     }
@@ -100,12 +100,12 @@ protected:
         operator Action() const { return code; }
 
         friend std::ostream& operator <<(std::ostream& out, const move& m) {
-            // out << m.code;
+            out << m.code;
             if (m.time) out << '(' << std::dec << m.time << ')';
             return out;
         }
         friend std::istream& operator >>(std::istream& in, move& m) {
-            // in >> m.code;
+            in >> m.code;
             m.time = 0;
             if (in.peek() == '(') {
                 in.ignore(1);
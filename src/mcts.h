@@ -1,98 +1,207 @@
 #pragma once
+#include <atomic>
 #include <cmath>
 #include <vector>
 #include <random>
 #include <list>
+#include <thread>
 #include "tree.h"
+#include "budget.h"
 #include "board.h"
+#include "action.h"
+#include "movelist.h"
 #include "tuple.h"
 #include "utilities.h"
 
+/**
+ * threads search the one tree together, each simulation is counted on the way down with
+ * a virtual loss (see Tree::add_virtual_loss), so that the others spread to other nodes
+ *
+ * with one thread (the default), the search is the same, and as deterministic, as a
+ * serial one; training searches use one thread, since training the weights is serial
+ */
 class MCTS {
 public:
-    MCTS(Tuple *tuple, bool with_tuple = false, bool is_training = false, int simulation_count = 5000, uint32_t seed = 10, float epsilon = 0.9) :
+    MCTS(Tuple *tuple, bool with_tuple = false, bool is_training = false, int simulation_count = 5000, uint32_t seed = 10, float epsilon = 0.9,
+         unsigned threads = 1) :
         tuple(tuple),
         with_tuple(with_tuple),
         is_training(is_training),
-        simulation_count(simulation_count),
-        epsilon(epsilon) { engine.seed(seed); }
-
-    void playing(Board &board, int player, int sim) {
-        TreeNode node = find_next_move(board, player, sim);
-        if (node.get_board() != board) {
-            board = node.get_board();
+        epsilon(epsilon),
+        reuse(true),
+        reused_visits(0),
+        nodes_per_simulation(32),
+        budget(simulation_count),
+        workers(is_training ? 1 : std::max(1u, threads)) {
+        for (unsigned k = 0; k < workers.size(); k++) {
+            workers[k].engine.seed(seed + k);
+            workers[k].random.seed(seed + k);
         }
     }
+    ~MCTS() { stop_pondering(); }
+
+    // play the best action on board, return the action (none if cannot move)
+    Action playing(Board &board, int player, int sim) {
+        const Tree::node node = find_next_move(board, player, sim);
+        if (node == tree.root()) return Action();
+        board.apply(tree.get_prev_action(node));
+        return tree.get_prev_action(node);
+    }
 
-    std::pair<std::string, unsigned> training(Board &board, int player, int sim) {
-        TreeNode node = find_next_move(board, player, sim);
-
-        // return best node's action
-        if (node.get_board() != board) {
-            board = node.get_board();
-            return node.get_prev_action();
-        }
+    Action training(Board &board, int player, int sim) {
+        const Tree::node node = find_next_move(board, player, sim);
 
         // cannot find child node
-        return std::make_pair("none", 0);
+        if (node == tree.root()) return Action();
+
+        // return best node's action
+        board.apply(tree.get_prev_action(node));
+        return tree.get_prev_action(node);
     }
 
-    // return board after best action
-    TreeNode find_next_move(Board board, int player, int sim) {
-        Tree tree(board);
-        TreeNode root = tree.get_root();
-        root.set_explore();
-        root.set_player(player);
+    /**
+     * return the child of the root to play, the root if there is none
+     *
+     * the subtree of board from the last search is kept (see Tree::find), and its visits
+     * count toward the simulations of this one; training searches start afresh, for the
+     * noise at the root
+     *
+     * pondering searches on the opponent's time, see Budget
+     */
+    Tree::node find_next_move(const Board &board, int player, int sim, bool pondering = false) {
+        const Tree::node known = reuse && !is_training ? tree.find(board, player) : Tree::none;
+        if (known != Tree::none) tree.reroot(known, board, player);
+        else tree.reset(board, player);
+        const Tree::node root = tree.root();
+        tree.advance(root, Tree::FRESH, Tree::EXPLORED);
+        reused_visits = tree.get_visit_count(root) - 2;
+        budget.start(reused_visits, pondering);
+        // each simulation expands one node at most, a few children on average, and the root all of them
+        const size_t kept = tree.size();
+        const int simulations = std::max(budget.get_limit() - reused_visits, 0) + 1;
+        tree.reserve(kept + MoveList::capacity + size_t(simulations * nodes_per_simulation));
 
         // if used in training, add dirichlet noise for exploration
-        if (is_training)   root_expansion(&root);
-
-        for (int i = 0; i < simulation_count; i++) {
-            // Phase 1 - Selection 
-            TreeNode* leaf = selection(&root);
-            // Phase 2 - Expansion
-            if (leaf->is_explore()) leaf = expansion(leaf);
-            leaf->set_explore();
-            // Phase 3 - Simulation
-            int value = simulation(leaf, sim);
-            // Phase 4 - Backpropagation
-            backpropagation(leaf, value);
-        }
+        if (is_training)   root_expansion();
+
+        std::atomic<int> next(reused_visits);
+        std::vector<std::thread> threads;
+        for (unsigned k = 1; k < workers.size(); k++)
+            threads.push_back(std::thread(&MCTS::search, this, std::ref(workers[k]), std::ref(next), sim));
+        search(workers[0], next, sim);
+        for (std::thread& th : threads) th.join();
+        budget.finish(tree.get_visit_count(root) - 2);
+        if (is_training) tuple->flush_updates();
+        // twice what this search made, or twice the reserve if it ran out, for the next one
+        const int done = tree.get_visit_count(root) - 2 - reused_visits;
+        if (tree.size() + MoveList::capacity > tree.reserved()) nodes_per_simulation *= 2;
+        else if (done > 0) nodes_per_simulation = std::max(2.0f * (tree.size() - kept) / done, 1.0f);
+        nodes_per_simulation = std::min<float>(nodes_per_simulation, MoveList::capacity);
 
         // cannot find move
-        if (root.get_all_child().size() == 0) return root;
+        if (tree.child_count(root) == 0) return root;
 
         if (is_training) { // pick child based on visit count distribution
             std::uniform_real_distribution<> dis(0, 1);
-            return root.get_child_with_temperature(dis(engine));
+            return tree.get_child_with_temperature(root, dis(workers[0].engine));
         }
         else { // pick best child with max visit count
-            return root.get_best_child_node();
+            return tree.get_best_child(root);
         }
     }
 
+    /**
+     * search board for player, the opponent, in the background until stop_pondering, so
+     * that the next search keeps the subtree of the move they play
+     */
+    void start_pondering(const Board &board, int player, int sim) {
+        stop_pondering();
+        ponderer = std::thread([this, board, player, sim] { find_next_move(board, player, sim, true); });
+    }
+
+    void stop_pondering() {
+        if (!ponderer.joinable()) return;
+        budget.cancel();
+        ponderer.join();
+        budget.cancel(false); // in case the search was over before the cancel
+    }
+
+    const Tree& get_tree() const { return tree; }
+    // the simulations, time and early stop of each search, see Budget
+    Budget& get_budget() { return budget; }
+    unsigned get_threads() const { return workers.size(); }
+
+    // pass false to start each search from a fresh tree
+    void set_reuse(bool reuse) { this->reuse = reuse; }
+    // the simulations of the last search that came from the previous ones
+    int get_reused_visits() const { return reused_visits; }
+
 private:
-    TreeNode* selection(TreeNode* root) {
+    // the nodes from the root to the leaf, with their boards
+    struct step {
+        Tree::node node;
+        Board board;
+        int player;
+    };
+
+    // what each search thread has of its own
+    struct worker {
+        std::default_random_engine engine;
+        FastRandom random; // for playouts
+        std::vector<step> path;
+    };
+
+    // the simulations of one thread, numbered by next, until the budget stops them
+    void search(worker &my, std::atomic<int> &next, int sim) {
+        while (!budget.stop(next.fetch_add(1, std::memory_order_relaxed), tree)) {
+            // Phase 1 - Selection
+            Tree::node leaf = selection(my);
+            // Phase 2 - Expansion, of a leaf simulated once already, by one thread only
+            const Tree::state state = tree.get_state(leaf);
+            if (state == Tree::FRESH) tree.advance(leaf, Tree::FRESH, Tree::EXPLORED);
+            else if (state == Tree::EXPLORED && tree.advance(leaf, Tree::EXPLORED, Tree::EXPANDING)) leaf = expansion(my);
+            // Phase 3 - Simulation
+            int value = simulation(my, my.path.back().board, my.path.back().player, sim);
+            // Phase 4 - Backpropagation
+            backpropagation(my, value);
+        }
+    }
+
+    // step into child of the last node of the path
+    void descend(worker &my, Tree::node child) {
+        Board board = my.path.back().board;
+        const int player = my.path.back().player ^ 1;
+        board.apply(tree.get_prev_action(child));
+        my.path.push_back({ child, board, player });
+        tree.add_virtual_loss(child);
+    }
+
+    Tree::node selection(worker &my) {
         // std::cout << "selection\n";
-        TreeNode* current_node = root;
-        TreeNode* best_child_node = nullptr;
+        Tree::node current_node = tree.root();
+        Tree::node best_child_node = Tree::none;
+        my.path.clear();
+        my.path.push_back({ current_node, tree.get_root_board(), tree.get_root_player() });
+        tree.add_virtual_loss(current_node);
 
-        while (current_node->get_all_child().size() != 0) {
+        while (tree.child_count(current_node) != 0) {
             float best_value = -1e9;
-            const float t = float(current_node->get_visit_count());
-            const float child_softmax_sum = current_node->get_child_softmax_total();
-            std::vector<TreeNode> &child = current_node->get_all_child();
+            const float t = float(tree.get_visit_count(current_node));
+            const float child_softmax_sum = tree.get_child_softmax_total(current_node);
+            const Tree::stats* child = tree.child_stats(current_node);
 
             // find the child with maximum PUCB value
-            for (size_t i = 0; i < child.size(); i++) {
-                float w = -float(child[i].get_win_count());
-                float n = float(child[i].get_visit_count());
+            for (size_t i = 0; i < tree.child_count(current_node); i++) {
+                // the simulations under way count as losses for the player choosing
+                const int loss = child[i].virtual_loss.load(std::memory_order_relaxed);
+                float w = -float(child[i].win_count.load(std::memory_order_relaxed) + loss);
+                float n = float(child[i].visit_count.load(std::memory_order_relaxed) + loss);
                 float q = w / n;
                 float value;
 
                 // check whether MCTS with tuple value
                 if (with_tuple) {
-                    float poly = child[i].get_softmax_value() / child_softmax_sum;
+                    float poly = child[i].softmax_value / child_softmax_sum;
                     float ucb = sqrt(t) / n;
                     value = q + poly * ucb * 3;
                 }
@@ -102,139 +211,103 @@ private:
 
                 if (best_value < value) {
                     best_value = value;
-                    best_child_node = &child[i];
+                    best_child_node = tree.get_child(current_node, i);
                 }
             }
             current_node = best_child_node;
+            descend(my, current_node);
         }
         return current_node;
     }
 
-    TreeNode* expansion(TreeNode* leaf) {
+    // expand the leaf this thread moved to EXPANDING, and step into one of its children
+    Tree::node expansion(worker &my) {
         // std::cout << "expansion\n";
-        const Board& board = leaf->get_board();
+        const Tree::node leaf = my.path.back().node;
+        const Board board = my.path.back().board;
         // no need to expand if game is over
-        if (board.game_over())  return leaf;
+        if (board.game_over()) {
+            tree.advance(leaf, Tree::EXPANDING, Tree::EXPLORED);
+            return leaf;
+        }
 
-        int player = leaf->get_player();
+        int player = my.path.back().player;
         float child_softmax_total = 0;
         const float softmax_coefficient = 4;
 
-        std::vector<unsigned> eats, moves;
-        board.get_possible_eat(eats, player);
-        board.get_possible_move(moves, player);
+        MoveList actions;
+        board.get_possible_action(actions, player);
+        float values[MoveList::capacity];
+        tuple->get_action_values(tuple->get_tuple_index(board, player), actions, player, values);
 
-        // expand all the possible child node, calculate tuple value, record previous action
-        for (unsigned code : eats) {
-            Board tmp = Board(board);
-            tmp.eat(code & 0b111111, (code >> 6) & 0b111111);
-            float state_value = tuple->get_board_value(tmp, player);
-            float softmax_value = exp(state_value * softmax_coefficient);
-            child_softmax_total += softmax_value;
-            leaf->get_all_child().push_back(TreeNode(
-                tmp,
-                state_value,
-                softmax_value,
-                player ^ 1,
-                leaf,
-                std::make_pair("eat", code)
-            ));
+        const Tree::node first = tree.allocate(actions.size());
+        if (first == Tree::none) { // out of the reserve, leave it to the next search
+            tree.advance(leaf, Tree::EXPANDING, Tree::EXPLORED);
+            return leaf;
         }
-        for (unsigned code : moves) {
-            Board tmp = Board(board);
-            tmp.move(code & 0b111111, (code >> 6) & 0b111111);
-            float state_value = tuple->get_board_value(tmp, player);
+
+        // expand all the possible child node with the softmax of its tuple value
+        for (unsigned i = 0; i < actions.size(); i++) {
+            float state_value = values[i];
             float softmax_value = exp(state_value * softmax_coefficient);
             child_softmax_total += softmax_value;
-            leaf->get_all_child().push_back(TreeNode(
-                tmp,
-                state_value,
-                softmax_value,
-                player ^ 1,
-                leaf,
-                std::make_pair("move", code)
-            ));
+            tree.init(first + i, leaf, actions[i], softmax_value);
         }
-        leaf->set_child_softmax_total(child_softmax_total);
+        tree.publish(leaf, first, actions.size(), child_softmax_total);
 
         // there are no actions can be made
-        if (leaf->get_all_child().size() == 0) return leaf;
+        if (actions.size() == 0) return leaf;
 
-        // randomly pick one child
-        std::uniform_int_distribution<int> dis(0, leaf->get_all_child().size() - 1);
-        return &(leaf->get_child(dis(engine)));
+        // randomly pick one child, simulated from here
+        std::uniform_int_distribution<int> dis(0, actions.size() - 1);
+        descend(my, tree.get_child(leaf, dis(my.engine)));
+        tree.advance(my.path.back().node, Tree::FRESH, Tree::EXPLORED);
+        return my.path.back().node;
     }
 
     // used in first layer, add dirichlet noise
-    void root_expansion(TreeNode* leaf) {
+    void root_expansion() {
         // std::cout << "expansion\n";
-        const Board& board = leaf->get_board();
+        const Tree::node leaf = tree.root();
+        const Board& board = tree.get_root_board();
         // no need to expand if game is over
         if (board.game_over())  return;
 
-        const int player = leaf->get_player();
+        const int player = tree.get_root_player();
         float child_softmax_total = 0;
 
-        std::vector<unsigned> eats, moves;
-        board.get_possible_eat(eats, player);
-        board.get_possible_move(moves, player);
+        MoveList actions;
+        board.get_possible_action(actions, player);
 
         float dir_sum = 0;
-        size_t child_size = eats.size() + moves.size();
-        std::vector<float> dirichlet;
+        const size_t child_size = actions.size();
+        float dirichlet[MoveList::capacity];
         std::gamma_distribution<float> gamma(0.3, 1.0f);
         
         for (size_t i = 0; i < child_size; i++) {
-            float dir = gamma(engine);
-            dirichlet.emplace_back(dir);
-            dir_sum += dir;
+            dirichlet[i] = gamma(workers[0].engine);
+            dir_sum += dirichlet[i];
         }
         if (dir_sum >= std::numeric_limits<float>::min()) {
-            for (float &v : dirichlet) v /= dir_sum;
+            for (size_t i = 0; i < child_size; i++) dirichlet[i] /= dir_sum;
         }
 
-        size_t child_counter = 0;
-        // expand all the possible child node, calculate tuple value, record previous action
-        for (unsigned code : eats) {
-            Board tmp = Board(board);
-            tmp.eat(code & 0b111111, (code >> 6) & 0b111111);
-            float state_value = tuple->get_board_value(tmp, player);
-            float d_state_value = 0.8 * state_value + 0.2 * dirichlet[child_counter++];
-            float softmax_value = exp(d_state_value);
-            child_softmax_total += softmax_value;
-            leaf->get_all_child().push_back(TreeNode(
-                tmp,
-                state_value,
-                softmax_value,
-                player ^ 1,
-                leaf,
-                std::make_pair("eat", code)
-            ));
-        }
-        for (unsigned code : moves) {
-            Board tmp = Board(board);
-            tmp.move(code & 0b111111, (code >> 6) & 0b111111);
-            float state_value = tuple->get_board_value(tmp, player);
-            float d_state_value = 0.8 * state_value + 0.2 * dirichlet[child_counter++];
+        // expand all the possible child node with the softmax of its noisy tuple value
+        float values[MoveList::capacity];
+        tuple->get_action_values(tuple->get_tuple_index(board, player), actions, player, values);
+        const Tree::node first = tree.allocate(child_size);
+        for (unsigned i = 0; i < child_size; i++) {
+            float state_value = values[i];
+            float d_state_value = 0.8 * state_value + 0.2 * dirichlet[i];
             float softmax_value = exp(d_state_value);
             child_softmax_total += softmax_value;
-            leaf->get_all_child().push_back(TreeNode(
-                tmp,
-                state_value,
-                softmax_value,
-                player ^ 1,
-                leaf,
-                std::make_pair("move", code)
-            ));
+            tree.init(first + i, leaf, actions[i], softmax_value);
         }
-        leaf->set_child_softmax_total(child_softmax_total);
+        tree.publish(leaf, first, child_size, child_softmax_total);
     }
 
-    int simulation(TreeNode *leaf, int sim) {
+    int simulation(worker &my, Board board, int player, int sim) {
         // std::cout << "simulation\n";
-        TreeNode leaf_copy(*leaf);
-        Board& board = leaf_copy.get_board();
-        int player = leaf_copy.get_player();
         const int origin_player = player;
         
         // check if game is over before simulation
@@ -245,87 +318,63 @@ private:
             else                    return white_bitcount - black_bitcount;
         }
 
-        std::uniform_real_distribution<> dis(0, 1);
-        std::vector<unsigned> eats, moves;
+        MoveList actions;
         std::list<Board> record;
 
+        // tuple indices from the view of each player, kept along the playout
+        TupleIndex view[2];
+        if (sim == 2) {
+            view[0] = tuple->get_tuple_index(board, 0);
+            view[1] = tuple->get_tuple_index(board, 1);
+        }
+
         // playout for at most 100 steps
         for (int i = 0; i < 100 && !board.game_over(); i++) {
-            eats.clear(); moves.clear();
-            board.get_possible_eat(eats, player);
-            board.get_possible_move(moves, player);
-            std::shuffle(moves.begin(), moves.end(), engine);
-            std::shuffle(eats.begin(), eats.end(), engine);
-
             // random
             if (sim == 0) {
-                int size1 = eats.size(), size2 = moves.size();
-                if (dis(engine) * (size1 + size2) < size1) {
-                    if (eats.size() > 0) {
-                        board.eat(eats[0] & 0b111111, (eats[0] >> 6) & 0b111111);
-                    }
-                }
-                else {
-                    if (moves.size() > 0) {
-                        board.move(moves[0] & 0b111111, (moves[0] >> 6) & 0b111111);
-                    }
+                board.get_possible_eat(actions, player);
+                const unsigned size1 = actions.size(), size2 = board.count_possible_move(player);
+                if (size1 + size2 > 0) {
+                    const unsigned k = my.random.bounded(size1 + size2);
+                    board.apply(k < size1 ? actions[k] : board.get_nth_move(player, k - size1));
                 }
             }
             // eat first
             else if (sim == 1) {
-                if (eats.size() > 0) {
-                    board.eat(eats[0] & 0b111111, (eats[0] >> 6) & 0b111111);
-                }
-                else if (moves.size() > 0) {
-                    board.move(moves[0] & 0b111111, (moves[0] >> 6) & 0b111111);
-                }
+                Action action = board.get_random_eat(player, my.random);
+                if (action.is_none()) action = board.get_random_move(player, my.random);
+                if (!action.is_none()) board.apply(action);
             }
             // tuple with ϵ-greedy
             else if (sim == 2) {
-                if (dis(engine) > epsilon) {
+                Action chosen;
+                if (my.random.uniform() > epsilon) {
+                    board.get_possible_action(actions, player);
+                    float values[MoveList::capacity];
+                    tuple->get_action_values(view[player], actions, player, values);
                     float best_value = -1e9;
-                    unsigned best_code = 0;
-                    int best_action_type;
-                    for (unsigned code : eats) {
-                        Board tmp = Board(board);
-                        tmp.eat(code & 0b111111, (code >> 6) & 0b111111);
-                        float value = tuple->get_board_value(tmp, player);
-                        if (value > best_value) {
-                            best_value = value;
-                            best_code = code;
-                            best_action_type = 0;
+                    for (unsigned j = 0; j < actions.size(); j++) {
+                        if (values[j] > best_value) {
+                            best_value = values[j];
+                            chosen = actions[j];
                         }
                     }
-                    for (unsigned code : moves) {
-                        Board tmp = Board(board);
-                        tmp.move(code & 0b111111, (code >> 6) & 0b111111);
-                        float value = tuple->get_board_value(tmp, player);
-                        if (value > best_value) {
-                            best_value = value;
-                            best_code = code;
-                            best_action_type = 1;
-                        }
-                    }
-                    if (best_code != 0) {
-                        if (!best_action_type)
-                            board.eat(best_code & 0b111111, (best_code >> 6) & 0b111111);
-                        else
-                            board.move(best_code & 0b111111, (best_code >> 6) & 0b111111);
-                    }
                 }
                 else {
-                    int size1 = eats.size(), size2 = moves.size();
-                    if (dis(engine) * (size1 + size2) < size1 * 5) {  // eat seems to be TOO important
-                        if (eats.size() > 0) {
-                            board.eat(eats[0] & 0b111111, (eats[0] >> 6) & 0b111111);
-                        }
+                    board.get_possible_eat(actions, player);
+                    const unsigned size1 = actions.size(), size2 = board.count_possible_move(player);
+                    if (my.random.uniform() * (size1 + size2) < size1 * 5) {  // eat seems to be TOO important
+                        if (size1 > 0) chosen = actions[my.random.bounded(size1)];
                     }
                     else {
-                        if (moves.size() > 0) {
-                            board.move(moves[0] & 0b111111, (moves[0] >> 6) & 0b111111);
-                        }
+                        if (size2 > 0) chosen = board.get_nth_move(player, my.random.bounded(size2));
                     }
                 }
+                if (!chosen.is_none()) {
+                    board.apply(chosen);
+                    tuple->update_tuple_index(view[0], chosen, player, 0);
+                    tuple->update_tuple_index(view[1], chosen, player, 1);
+                }
             }
             if (is_training) record.emplace_back(board.get_board(0 ^ player), board.get_board(1 ^ player));
             player ^= 1; // toggle player
@@ -349,17 +398,16 @@ private:
         else                    return white_bitcount - black_bitcount;
     }
 
-    void backpropagation(TreeNode *node, int value) {
+    // from the leaf up to the root, which takes the virtual losses back
+    void backpropagation(worker &my, int value) {
         // std::cout << "backpropagation\n";
         float result = value;
-        while (node != NULL) {
+        for (size_t i = my.path.size(); i-- > 0; ) {
             if (is_training) {
                 result *= -1;
-                tuple->train_weight(node->get_board(), result, 1);
+                tuple->train_weight(my.path[i].board, result, 1);
             }
-            node->add_visit_count();
-            if (value > 0) node->add_win_count();
-            node = node->get_parent();
+            tree.add_result(my.path[i].node, value > 0);
             value *= -1;
         }
     }
@@ -368,7 +416,12 @@ private:
     Tuple *tuple;
     const bool with_tuple;
     const bool is_training;
-    const int simulation_count;
     float epsilon;
-    std::default_random_engine engine;
+    bool reuse;
+    int reused_visits;
+    float nodes_per_simulation; // the nodes to reserve for each simulation
+    Budget budget;
+    std::vector<worker> workers; // the first one is the calling thread
+    Tree tree;                   // kept from one search to the next, for its memory
+    std::thread ponderer;
 };
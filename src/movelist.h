@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include "action.h"
+
+/**
+ * fixed-capacity move list living on the stack
+ *
+ * the bound comes from the 6*6 board
+ *  eat : each of the 4 circles has 4 segments, and each segment has at most one eater
+ *  move: each side has at most 12 pieces, and each piece has at most 8 neighbors
+ */
+class MoveList {
+public:
+    static const unsigned max_eat = 4 * 4;
+    static const unsigned max_move = 12 * 8;
+    static const unsigned capacity = max_eat + max_move;
+
+public:
+    MoveList() : count(0) {}
+
+    void push_back(Action action) { codes[count++] = action; }
+    void clear() { count = 0; }
+    void resize(size_t size) { count = size; }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    Action& operator[] (size_t i) { return codes[i]; }
+    const Action& operator[] (size_t i) const { return codes[i]; }
+
+    Action* begin() { return codes; }
+    Action* end() { return codes + count; }
+    const Action* begin() const { return codes; }
+    const Action* end() const { return codes + count; }
+
+private:
+    Action codes[capacity];
+    size_t count;
+};
@@ -0,0 +1,190 @@
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "board.h"
+#include "action.h"
+#include "movelist.h"
+#include "utilities.h"
+
+/**
+ * perft: count the leaf nodes of the move tree to a fixed depth,
+ * to verify and time the move generators
+ *
+ * --perft=N             depth (5 by default)
+ * --black=, --white=    start position in hex, like tournament mode
+ * --player=             side to move, 0 for black (default) or 1 for white
+ * --verify              check the generators against the golden table
+ */
+
+struct perft_golden {
+    Board::data black;
+    Board::data white;
+    int player;
+    int depth;
+    uint64_t nodes;
+};
+
+/**
+ * counted with the original CIRCLE scan and NEIGHBOR loop generators, as standard perft
+ * numbers (see perft_count): the positions reached at the depth, none past a game over
+ *
+ * the last position, counted with a plain recursion instead, ends the game in some lines:
+ * white has a single piece black can capture
+ */
+static const perft_golden PERFT_GOLDEN[] = {
+    { 0x00000000007E7E00ULL, 0x007E7E0000000000ULL, 0, 1, 16 },
+    { 0x00000000007E7E00ULL, 0x007E7E0000000000ULL, 0, 2, 256 },
+    { 0x00000000007E7E00ULL, 0x007E7E0000000000ULL, 0, 3, 5382 },
+    { 0x00000000007E7E00ULL, 0x007E7E0000000000ULL, 0, 4, 111122 },
+    { 0x00000000007E7E00ULL, 0x007E7E0000000000ULL, 0, 5, 2572484 },
+    { 0x0000001A22440600ULL, 0x0026500000000000ULL, 0, 1, 38 },
+    { 0x0000001A22440600ULL, 0x0026500000000000ULL, 0, 2, 723 },
+    { 0x0000001A22440600ULL, 0x0026500000000000ULL, 0, 3, 27795 },
+    { 0x0000001A22440600ULL, 0x0026500000000000ULL, 0, 4, 547418 },
+    { 0x0000001A22440600ULL, 0x0026500000000000ULL, 0, 5, 21058545 },
+    { 0x0020080000000200ULL, 0x0000002000000000ULL, 0, 1, 19 },
+    { 0x0020080000000200ULL, 0x0000002000000000ULL, 0, 2, 168 },
+    { 0x0020080000000200ULL, 0x0000002000000000ULL, 0, 3, 2594 },
+    { 0x0020080000000200ULL, 0x0000002000000000ULL, 0, 4, 19232 },
+    { 0x0020080000000200ULL, 0x0000002000000000ULL, 0, 5, 292542 },
+};
+
+// the standard convention: a position at depth 0 counts 1, and a game over has no moves
+uint64_t perft_count(const Board &board, int player, int depth) {
+    if (depth <= 0) return 1;
+    if (board.game_over()) return 0;
+    MoveList actions;
+    board.get_possible_action(actions, player);
+    if (depth == 1) return actions.size(); // the leaves at once
+
+    uint64_t nodes = 0;
+    for (const Action &action : actions) {
+        Board tmp = Board(board);
+        tmp.apply(action);
+        nodes += perft_count(tmp, player ^ 1, depth - 1);
+    }
+    return nodes;
+}
+
+// collect the interior positions of the move tree, for timing the generators alone
+void perft_collect(const Board &board, int player, int depth, std::vector<std::pair<Board, int>> &positions) {
+    positions.emplace_back(board, player);
+    if (depth <= 1 || positions.size() >= 200000) return;
+
+    MoveList actions;
+    board.get_possible_action(actions, player);
+    for (const Action &action : actions) {
+        Board tmp = Board(board);
+        tmp.apply(action);
+        perft_collect(tmp, player ^ 1, depth - 1, positions);
+    }
+}
+
+double perft_seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int perft_verify() {
+    int failed = 0;
+    for (const perft_golden &g : PERFT_GOLDEN) {
+        Board board(g.black, g.white);
+        auto start = std::chrono::steady_clock::now();
+        uint64_t nodes = perft_count(board, g.player, g.depth);
+        double sec = perft_seconds(start);
+        bool ok = nodes == g.nodes;
+        if (!ok) failed++;
+        std::cout << std::hex << std::setfill('0') << std::setw(16) << g.black << " "
+                  << std::setw(16) << g.white << std::dec << std::setfill(' ')
+                  << " depth " << g.depth << ": " << nodes
+                  << (ok ? " ok" : " FAIL (expected " + std::to_string(g.nodes) + ")");
+        if (sec > 0) std::cout << std::fixed << std::setprecision(0) << "  " << nodes / sec << " nodes/sec";
+        std::cout << std::endl;
+    }
+    std::cout << (failed ? "perft verify failed" : "perft verify passed") << std::endl;
+    return failed ? 1 : 0;
+}
+
+// time each generator over the same positions
+void perft_generators(const Board &board, int player, int depth) {
+    std::vector<std::pair<Board, int>> positions;
+    perft_collect(board, player, depth, positions);
+
+    const char* name[] = { "eat", "move", "action", "attack" };
+    for (int g = 0; g < 4; g++) {
+        MoveList actions;
+        uint64_t calls = 0, generated = 0;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            for (const auto &p : positions) {
+                switch (g) {
+                    case 0: p.first.get_possible_eat(actions, p.second); break;
+                    case 1: p.first.get_possible_move(actions, p.second); break;
+                    case 2: p.first.get_possible_action(actions, p.second); break;
+                    case 3: {
+                        Board::AttackMap map = p.first.get_attack_map();
+                        actions.resize(Bitcount(map.attacked[p.second]));
+                        break;
+                    }
+                }
+                generated += actions.size();
+            }
+            calls += positions.size();
+        } while (perft_seconds(start) < 0.2);
+        double sec = perft_seconds(start);
+        std::cout << std::left << std::setw(8) << name[g] << std::right << std::fixed << std::setprecision(0)
+                  << calls / sec << " calls/sec, " << generated / sec << " moves/sec" << std::endl;
+    }
+}
+
+/* command line interface to count and time move generation */
+int perft(int argc, const char* argv[]) {
+    int depth = 5, player = 0;
+    bool verify = false;
+    Board board;
+
+    for (int i = 1; i < argc; i++) {
+        std::string para(argv[i]);
+        if (para.find("--perft=") == 0) {
+            depth = std::stoi(para.substr(para.find("=") + 1));
+        } else if (para.find("--black=") == 0) {
+            uint64_t black = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
+            board.set_black(black);
+        } else if (para.find("--white=") == 0) {
+            uint64_t white = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
+            board.set_white(white);
+        } else if (para.find("--player=") == 0) {
+            player = std::stoi(para.substr(para.find("=") + 1));
+        } else if (para.find("--verify") == 0) {
+            verify = true;
+        }
+    }
+
+    if (verify) return perft_verify();
+
+    // divide: the leaf nodes under each root move
+    auto start = std::chrono::steady_clock::now();
+    MoveList actions;
+    board.get_possible_action(actions, player);
+    uint64_t total = 0;
+    for (const Action &action : actions) {
+        Board tmp = Board(board);
+        tmp.apply(action);
+        uint64_t nodes = perft_count(tmp, player ^ 1, depth - 1);
+        total += nodes;
+        std::cout << action.name() << " " << Action::square(action.origin()) << " "
+                  << Action::square(action.destination()) << ": " << nodes << std::endl;
+    }
+    double sec = perft_seconds(start);
+
+    std::cout << std::endl << "Depth: " << depth << std::endl;
+    std::cout << "Nodes: " << total << std::endl;
+    std::cout << std::fixed << std::setprecision(3) << "Time: " << sec << " s" << std::endl;
+    if (sec > 0) std::cout << std::setprecision(0) << "Nodes/sec: " << total / sec << std::endl;
+    std::cout << std::endl;
+
+    perft_generators(board, player, depth);
+    return 0;
+}
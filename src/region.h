@@ -0,0 +1,194 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "utilities.h"
+
+/**
+ * memory of weight tables from mmap, unmapped when the last table using it is gone
+ *
+ *  anonymous: zero pages, faulted in on first write
+ *  shared   : a weight file read-only, one physical copy for every process mapping it
+ *  private  : a weight file copy-on-write, for training on loaded weights
+ *
+ * anonymous regions ask for huge pages, since the tables are read at random:
+ *  small      : 4 kB pages only
+ *  transparent: madvise(MADV_HUGEPAGE), the kernel backs what it can with 2 MB pages
+ *  hugetlb    : MAP_HUGETLB from the reserved pool, falls back to transparent
+ */
+class Region {
+public:
+    enum mode { ANONYMOUS, SHARED, PRIVATE };
+    enum pages { SMALL, TRANSPARENT, HUGETLB };
+
+    ~Region() { if (base) munmap(base, length); }
+
+    static std::shared_ptr<Region> allocate(size_t length, pages want = TRANSPARENT) {
+        if (length == 0) return std::make_shared<Region>(nullptr, 0, ANONYMOUS, SMALL);
+        if (want == HUGETLB) {
+            const size_t huge = 2 << 20;
+            const size_t rounded = (length + huge - 1) / huge * huge;
+            void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) return std::make_shared<Region>(static_cast<char*>(p), rounded, ANONYMOUS, HUGETLB);
+            want = TRANSPARENT;
+        }
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        if (want == TRANSPARENT && madvise(p, length, MADV_HUGEPAGE) != 0) want = SMALL;
+        return std::make_shared<Region>(static_cast<char*>(p), length, ANONYMOUS, want);
+    }
+
+    // nullptr if the file cannot be mapped
+    static std::shared_ptr<Region> map(const std::string& path, mode how) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            p = (how == SHARED) ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                                : mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); // the mapping keeps the file
+        if (p == MAP_FAILED) return nullptr;
+        return std::make_shared<Region>(static_cast<char*>(p), size_t(st.st_size), how, SMALL);
+    }
+
+    char* data() const { return base; }
+    size_t size() const { return length; }
+    mode get_mode() const { return how; }
+    pages get_pages() const { return got; }
+    bool writable() const { return how != SHARED; }
+
+    /**
+     * fault in [p, p + len) with some threads, before the first search instead of during it
+     *
+     * anonymous pages are written to get private pages, file pages are read in
+     */
+    void prefault(char* p, size_t len, unsigned threads) const {
+        if (len == 0) return;
+        const size_t page = sysconf(_SC_PAGESIZE);
+        if (how != ANONYMOUS) madvise(align_down(p, page), len + (p - align_down(p, page)), MADV_WILLNEED);
+        const size_t pages = (len + page - 1) / page;
+        const bool write = how == ANONYMOUS;
+        auto touch = [=](size_t from, size_t to) {
+            unpin_thread(); // spread over all cpus, even if started by a pinned thread
+            volatile char* v = p;
+            for (size_t i = from; i < to; i++) {
+                if (write) v[i * page] = 0;
+                else (void) v[i * page];
+            }
+        };
+        std::vector<std::thread> workers;
+        threads = std::max(1u, threads);
+        for (unsigned t = 0; t < threads; t++) {
+            workers.emplace_back(touch, pages * t / threads, pages * (t + 1) / threads);
+        }
+        for (std::thread& w : workers) w.join();
+    }
+
+public:
+    /**
+     * NUMA placement by mbind(2), without linking libnuma
+     *
+     * interleave spreads the pages over all nodes, bind keeps them on one node;
+     * pages already faulted in are moved
+     */
+    static unsigned numa_nodes() {
+        std::ifstream in("/sys/devices/system/node/online");
+        std::string list;
+        unsigned nodes = 1;
+        if (!(in >> list)) return nodes;
+        std::stringstream ss(list);
+        for (std::string range; std::getline(ss, range, ','); ) {
+            const size_t dash = range.find('-');
+            nodes = std::max(nodes, unsigned(std::stoul(range.substr(dash == std::string::npos ? 0 : dash + 1))) + 1);
+        }
+        return nodes;
+    }
+
+    bool interleave() { return place(3 /* MPOL_INTERLEAVE */, (numa_nodes() >= 64) ? ~0UL : (1UL << numa_nodes()) - 1); }
+    bool bind(unsigned node) { return place(2 /* MPOL_BIND */, 1UL << node); }
+
+    // the node of the calling thread, looked up once per thread
+    static unsigned current_node() {
+        static thread_local int node = -1;
+        if (node < 0) {
+            unsigned cpu = 0, n = 0;
+            node = syscall(SYS_getcpu, &cpu, &n, nullptr) == 0 ? int(n) : 0;
+        }
+        return unsigned(node);
+    }
+
+    /**
+     * the page size backing some ranges as mapped now, from /proc/self/smaps, e.g.
+     * "4 kB pages", "2048 kB hugetlb pages", "4 kB pages, 240 of 246 MB on THP"
+     *
+     * adjacent regions may share one mapping, so each mapping is counted once
+     */
+    static std::string backing(const std::vector<std::pair<const char*, size_t>>& ranges, pages got) {
+        std::ifstream smaps("/proc/self/smaps");
+        bool inside = false;
+        size_t kernel_page = 0, anon_huge = 0, total = 0;
+        for (const auto& r : ranges) total += r.second;
+        for (std::string line; std::getline(smaps, line); ) {
+            unsigned long start, end;
+            char dash;
+            std::stringstream ss(line);
+            if (line.find(':') == std::string::npos || line.find('-') < line.find(':')) {
+                if (ss >> std::hex >> start >> dash >> end && dash == '-') {
+                    inside = false;
+                    for (const auto& r : ranges) {
+                        const uintptr_t from = reinterpret_cast<uintptr_t>(r.first);
+                        inside |= r.second && start < from + r.second && end > from;
+                    }
+                }
+                continue;
+            }
+            if (!inside) continue;
+            std::string key;
+            size_t kb = 0;
+            ss >> key >> kb;
+            if (key == "KernelPageSize:") kernel_page = std::max(kernel_page, kb);
+            else if (key == "AnonHugePages:") anon_huge += kb;
+        }
+        std::string result = std::to_string(kernel_page ? kernel_page : 4) + " kB ";
+        result += (got == HUGETLB) ? "hugetlb pages" : "pages";
+        if (got == TRANSPARENT) result += ", " + std::to_string(std::min(anon_huge / 1024, total >> 20)) + " of " + std::to_string(total >> 20) + " MB on THP";
+        return result;
+    }
+
+public:
+    Region(char* base, size_t length, mode how, pages got) : base(base), length(length), how(how), got(got) {}
+    Region(const Region&) = delete;
+    Region& operator =(const Region&) = delete;
+
+private:
+    static char* align_down(char* p, size_t page) {
+        return reinterpret_cast<char*>(reinterpret_cast<uintptr_t>(p) & ~(page - 1));
+    }
+
+    bool place(int policy, unsigned long mask) {
+        if (!base || numa_nodes() < 2) return false;
+        const unsigned long move = 1 << 1; // MPOL_MF_MOVE
+        return syscall(SYS_mbind, base, length, policy, &mask, sizeof(mask) * 8, move) == 0;
+    }
+
+private:
+    char* base;
+    size_t length;
+    mode how;
+    pages got;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * open-addressing table counting how many times a position (zobrist key) occurs
+ *
+ * linear probing on a power-of-two table, which grows when it is half full
+ */
+class Repetition {
+public:
+    Repetition(size_t capacity = 512) : used(0) {
+        size_t size = 16;
+        while (size < capacity * 2) size <<= 1;
+        slots.resize(size);
+    }
+
+    void clear() {
+        std::fill(slots.begin(), slots.end(), slot());
+        used = 0;
+    }
+
+    // count one more occurrence of key, return the number of occurrences
+    int add(uint64_t key) {
+        if ((used + 1) * 2 > slots.size()) grow();
+        slot& s = find(key);
+        if (s.count == 0) {
+            s.key = key;
+            used++;
+        }
+        return ++s.count;
+    }
+
+private:
+    struct slot {
+        uint64_t key;
+        int count;
+        slot() : key(0), count(0) {}
+    };
+
+    slot& find(uint64_t key) {
+        const size_t mask = slots.size() - 1;
+        size_t i = key & mask;
+        while (slots[i].count && slots[i].key != key) i = (i + 1) & mask;
+        return slots[i];
+    }
+
+    void grow() {
+        std::vector<slot> old(slots.size() * 2);
+        old.swap(slots);
+        for (const slot& s : old) {
+            if (s.count) find(s.key) = s;
+        }
+    }
+
+private:
+    std::vector<slot> slots;
+    size_t used;
+};
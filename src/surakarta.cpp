@@ -11,13 +11,17 @@
 #include "utilities.h"
 #include "mcts.h"
 #include "tournament.h"
+#include "perft.h"
+#include "benchmark.h"
 
 const std::string PLAYER[] = {"MCTS_with_tuple", "MCTS", "tuple", "eat_first"};
 const std::string SIMULATION[] = {"(random)", "(eat-first)", "(tuple)"};
 std::mutex mtx;
 int fight_black_win, fight_white_win;
+bool pin_threads = false; // --pin: the training loop on cpu 0, the fight threads on the next cpus
 
-void fight_thread(int player1, int player2, int sim1, int sim2, Tuple *tuple, int game_count, uint32_t seed) {
+void fight_thread(int player1, int player2, int sim1, int sim2, Tuple *tuple, int game_count, uint32_t seed, unsigned cpu) {
+    if (pin_threads) pin_thread(cpu);
     MCTS mcts_tuple(tuple, true, false, 5000, seed, 0.0);
     MCTS mcts(tuple, false, false, 5000, seed, 0.0);
     TuplePlayer tuple_player(tuple);
@@ -85,7 +89,7 @@ void fight(int player1, int player2, int sim1, int sim2, Tuple *tuple, int game_
     std::vector<std::thread> threads;
     std::random_device rd;
     for(int i = 0; i < 5; i++) {
-        threads.push_back(std::thread(fight_thread, player1, player2, sim1, sim2, tuple, game_count / 5, rd()));
+        threads.push_back(std::thread(fight_thread, player1, player2, sim1, sim2, tuple, game_count / 5, rd(), i + 1));
     }
     for (auto& th : threads) {
         th.join();
@@ -113,6 +117,10 @@ int main(int argc, const char* argv[]) {
         std::string para(argv[i]);
         if (para.find("--tour") == 0) {
             return tournament(argc, argv);
+        } else if (para.find("--perft") == 0) {
+            return perft(argc, argv);
+        } else if (para.find("--bench") == 0) {
+            return benchmark(argc, argv);
         } else if (para.find("--total=") == 0) {
             total = std::stoull(para.substr(para.find("=") + 1));
         } else if (para.find("--block=") == 0) {
@@ -125,10 +133,14 @@ int main(int argc, const char* argv[]) {
             tuple_args = para.substr(para.find("=") + 1);
         } else if (para.find("--epsilon=") == 0) {
             epsilon = std::stof(para.substr(para.find("=") + 1));
+        } else if (para.find("--pin") == 0) {
+            pin_threads = true;
         }
     }
 
+    if (pin_threads) pin_thread(0);
     Tuple tuple(tuple_args);
+    std::cout << "Tuple: " << tuple.placement() << std::endl << std::endl;
     TrainingPlayer play1(0, &tuple, epsilon), play2(1, &tuple, epsilon);
     Statistic stat(total, block, limit);
 
@@ -181,10 +193,16 @@ int main(int argc, const char* argv[]) {
             fight(1, 0, 1, 2, &tuple, game_count);
         }
 
+        // written in the background, only the chunks trained since the last one, and every
+        // 1000 episodes compacted into a numbered snapshot
         if (stat.episode_count() % 1000 == 0) {
             int i = stat.episode_count() / 1000 + 1;
             std::string pathname = "./weight_decay_tuple_" + std::to_string(i) + ".bin";
-            tuple.save_weights(pathname);
+            tuple.checkpoint("./weight_decay_tuple.bin", pathname);
+            std::cout << "Checkpoint: " << tuple.checkpoint_stats() << std::endl;
+        }
+        else if (stat.episode_count() % 100 == 0) {
+            tuple.checkpoint("./weight_decay_tuple.bin");
         }
     }
     return 0;
@@ -1,79 +1,101 @@
-#pragma once
-#include "board.h"
-#include "agent.h"
-#include "mcts.h"
-#include "tuple.h"
-#include "utilities.h"
-
-/* command line interface to play with other opponent */
-int tournament(int argc, const char* argv[]) {
-    std::string tuple_args;
-    int we = 1, opponent = 0;
-    Board board;
-
-    for (int i = 1; i < argc; i++) {
-        std::string para(argv[i]);
-        if (para.find("--tuple=") == 0) {
-            tuple_args = para.substr(para.find("=") + 1);
-        } else if (para.find("--black=") == 0) {
-            uint64_t black = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
-            board.set_black(black);
-        } else if (para.find("--white=") == 0) {
-            uint64_t white = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
-            board.set_white(white);
-        } else if (para.find("--first") == 0) {
-            we = 0; opponent = 1;
-        }
-    }
-
-    // std::cout << std::hex << board.get_board(0) << std::endl;
-    // std::cout << std::hex << board.get_board(1) << std::endl;
-
-    Tuple tuple(tuple_args);
-    MCTS mcts_tuple(&tuple, true, false, 50000);
-    int current = 0;
-
-    std::cout << "Start" << std::endl;
-    while (true) {
-        if (current == opponent) {
-            std::cout << "Opponent's turn: ";
-            std::string ori_str, dest_str;
-            std::cin >> ori_str >> dest_str;
-            unsigned ori = (ori_str.at(0) - '0') * 8 + (ori_str.at(1) - 'a' + 1);
-            unsigned dest = (dest_str.at(0) - '0') * 8 + (dest_str.at(1) - 'a' + 1);
-
-            uint64_t is_eat = (1ULL << dest) & board.get_board(we);
-            if (is_eat) board.eat(ori, dest);
-            else        board.move(ori, dest);
-        }
-        else {
-            Board before(board);
-            mcts_tuple.playing(board, we, 1);
-
-            uint64_t before_chess = before.get_board(we);
-            uint64_t after_chess = board.get_board(we);
-            if (before_chess == after_chess) {
-                std::cout << "oops! cannot move" << std::endl;
-                break;
-            }
-
-            uint64_t ori = (before_chess ^ after_chess) & before_chess;
-            uint64_t dest = (before_chess ^ after_chess) & after_chess;
-            std::string type = (dest & before.get_board(opponent)) ? "eat" : "move";
-
-            std::string ori_str = std::to_string(lsb_index(ori) / 8) +
-                                  char(lsb_index(ori) % 8 + 'a' - 1);
-            std::string dest_str = std::to_string(lsb_index(dest) / 8) +
-                                   char(lsb_index(dest) % 8 + 'a' - 1);
-            std::cout << type << " " << ori_str << " " << dest_str << std::endl;
-        }
-
-        if (board.game_over()) {
-            if (current == opponent)    std::cout << "We lose!" << std::endl;
-            else                        std::cout << "We win!" << std::endl;
-            break;
-        }
-        current ^= 1;
-    }
-    return 0;
+#pragma once
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "mcts.h"
+#include "tuple.h"
+#include "utilities.h"
+
+/* command line interface to play with other opponent */
+int tournament(int argc, const char* argv[]) {
+    std::string tuple_args;
+    int we = 1, opponent = 0;
+    unsigned threads = 1;
+    bool ponder = true;
+    int simulations = 50000;
+    int64_t move_ms = 0, clock_ms = -1, increment_ms = 0;
+    Board board;
+
+    for (int i = 1; i < argc; i++) {
+        std::string para(argv[i]);
+        if (para.find("--tuple=") == 0) {
+            tuple_args = para.substr(para.find("=") + 1);
+        } else if (para.find("--black=") == 0) {
+            uint64_t black = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
+            board.set_black(black);
+        } else if (para.find("--white=") == 0) {
+            uint64_t white = std::stoull(para.substr(para.find("=") + 1), NULL, 16);
+            board.set_white(white);
+        } else if (para.find("--first") == 0) {
+            we = 0; opponent = 1;
+        } else if (para.find("--threads=") == 0) { // search threads, see MCTS
+            threads = std::stoul(para.substr(para.find("=") + 1));
+        } else if (para.find("--no-ponder") == 0) {   // no search while the opponent thinks
+            ponder = false;
+        } else if (para.find("--simulations=") == 0) { // the most simulations of a move
+            simulations = std::stoi(para.substr(para.find("=") + 1));
+        } else if (para.find("--move-time=") == 0) {   // the most milliseconds of a move
+            move_ms = std::stoll(para.substr(para.find("=") + 1));
+        } else if (para.find("--clock=") == 0) {       // milliseconds on our clock for the game, see Budget::allot
+            clock_ms = std::stoll(para.substr(para.find("=") + 1));
+        } else if (para.find("--increment=") == 0) {   // milliseconds our clock gains each move
+            increment_ms = std::stoll(para.substr(para.find("=") + 1));
+        }
+    }
+
+    // std::cout << std::hex << board.get_board(0) << std::endl;
+    // std::cout << std::hex << board.get_board(1) << std::endl;
+
+    // inference only, so processes on one host share the mapped weights, unless --tuple= says
+    // otherwise; pass cache=N there to cache the values
+    Tuple tuple("map=shared " + tuple_args);
+    std::cerr << "Tuple: " << tuple.placement() << std::endl;
+    MCTS mcts_tuple(&tuple, true, false, simulations, 10, 0.9, threads);
+    mcts_tuple.get_budget().set_move_time(move_ms);
+    mcts_tuple.get_budget().set_clock(clock_ms, increment_ms);
+    mcts_tuple.get_budget().set_early_stop(true);
+    std::cerr << "Search: " << mcts_tuple.get_threads() << " threads" << std::endl;
+    int current = 0;
+
+    std::cout << "Start" << std::endl;
+    while (true) {
+        if (current == opponent) {
+            std::cout << "Opponent's turn: ";
+            std::string ori_str, dest_str;
+            // search on their time, the subtree of their move is kept for ours
+            if (ponder) mcts_tuple.start_pondering(board, opponent, 1);
+            std::cin >> ori_str >> dest_str;
+            if (ponder) {
+                mcts_tuple.stop_pondering();
+                std::cerr << "Ponder: " << mcts_tuple.get_budget().stats() << std::endl;
+            }
+            unsigned ori = Action::square(ori_str);
+            unsigned dest = Action::square(dest_str);
+
+            uint64_t is_eat = (1ULL << dest) & board.get_board(we);
+            board.apply(is_eat ? Action::Eat(ori, dest) : Action::Move(ori, dest));
+        }
+        else {
+            Action action = mcts_tuple.playing(board, we, 1);
+            if (action.is_none()) {
+                std::cout << "oops! cannot move" << std::endl;
+                break;
+            }
+
+            std::cout << action.name() << " " << Action::square(action.origin()) << " "
+                      << Action::square(action.destination()) << std::endl;
+            std::cerr << "Tree: " << mcts_tuple.get_reused_visits() << " simulations reused, "
+                      << mcts_tuple.get_tree().size() << " nodes" << std::endl;
+            std::cerr << "Search: " << mcts_tuple.get_budget().stats() << std::endl;
+            std::cerr << "Cache: " << tuple.cache_stats() << std::endl;
+        }
+
+        if (board.game_over()) {
+            if (current == opponent)    std::cout << "We lose!" << std::endl;
+            else                        std::cout << "We win!" << std::endl;
+            break;
+        }
+        current ^= 1;
+    }
+    return 0;
 }
\ No newline at end of file
@@ -1,115 +1,245 @@
 #pragma once
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include "board.h"
-
-class TreeNode {
-public:
-    TreeNode() {}
-    TreeNode(const Board &b) : 
-        parent(NULL),
-        board(b),
-        win_count(1),
-        visit_count(2),
-        win_rate(0.0f),
-        state_value(0.0f),
-        softmax_value(1.0f),
-        player(0),
-        explore(false),
-        prev_action(std::make_pair("none", 0)) { child.clear(); }
-
-    TreeNode(const Board &b,
-             float state_value,
-             float softmax_value,
-             int player,
-             TreeNode* parent,
-             std::pair<std::string, unsigned> prev_action) : 
-        parent(parent),
-        board(b),
-        win_count(1),
-        visit_count(2),
-        win_rate(0.0f),
-        state_value(state_value),
-        softmax_value(softmax_value),
-        player(player),
-        explore(false),
-        prev_action(prev_action) { child.clear(); }
-
-    TreeNode(const TreeNode& node) = default;
-    TreeNode& operator =(const TreeNode& node) = default;
-
+#include "action.h"
+#include "region.h"
+
+/**
+ * the search tree of MCTS, with its nodes in arrays indexed by 32-bit ids
+ *
+ * a node is 32 bytes in two parts: the statistics selection reads for every child
+ * (wins, visits, virtual loss, prior), and the links it follows once per level (parent,
+ * children) with the move and the state; the children of a node have contiguous ids
+ *
+ * nodes keep no board, selection replays the moves from the root board instead
+ *
+ * reset() drops the whole tree at once and keeps the memory for the next search, and
+ * reroot() keeps the subtree of the position reached since the last search
+ *
+ * the arrays are reserved before a search (see reserve), so that search threads can share
+ * the tree: they allocate children with an atomic counter, count with atomics, and a
+ * node is expanded once, by the thread that moves its state from EXPLORED to EXPANDING,
+ * which publishes the children with EXPANDED
+ */
+class Tree {
 public:
-    TreeNode* get_parent() { return parent; }
-    void set_parent(TreeNode *parent) { this->parent = parent; }
-
-    Board& get_board() { return board; }
-    const Board& get_board() const { return board; }
+    typedef uint32_t node;
+    static const node none = 0xFFFFFFFFu;
+    enum state : uint8_t { FRESH, EXPLORED, EXPANDING, EXPANDED };
+
+    struct stats {
+        std::atomic<int> win_count;
+        std::atomic<int> visit_count;
+        std::atomic<int> virtual_loss;   // simulations under way below the node
+        float softmax_value;
+    };
+
+    Tree() : root_player(0), hot(nullptr), link(nullptr), capacity(0), used(0) {}
+
+    // a tree of the root alone, for player to move on b
+    void reset(const Board &b, int player) {
+        root_board = b;
+        root_player = player;
+        used = 0;
+        reserve(1);
+        init(allocate(1), none, Action(), 1.0f);
+    }
 
-    int get_win_count() { return win_count; }
-    void add_win_count() { win_count++; }
+    node root() const { return 0; }
+    const Board& get_root_board() const { return root_board; }
+    int get_root_player() const { return root_player; }
+    size_t size() const { return used.load(std::memory_order_relaxed); }
+    size_t bytes() const { return size() * (sizeof(stats) + sizeof(links)); }
+    size_t reserved() const { return capacity; }
+
+    // room for nodes in all, the pages are only touched when the nodes are made
+    void reserve(size_t nodes) {
+        if (nodes <= capacity) return;
+        std::shared_ptr<Region> h = Region::allocate(nodes * sizeof(stats)), l = Region::allocate(nodes * sizeof(links));
+        stats* to_hot = reinterpret_cast<stats*>(h->data());
+        links* to_link = reinterpret_cast<links*>(l->data());
+        for (node n = 0; n < size(); n++) copy(to_hot[n], to_link[n], hot[n], link[n]);
+        hot_memory = h;
+        link_memory = l;
+        hot = to_hot;
+        link = to_link;
+        capacity = nodes;
+    }
 
-    int get_visit_count() { return visit_count; }
-    void add_visit_count() { visit_count++; }
+    /**
+     * the node of board with player to move, among the root and the nodes one or two moves
+     * below it (our move, then the reply), none if the tree does not have it
+     */
+    node find(const Board &b, int player) const {
+        if (size() == 0) return none;
+        if (player == root_player && b == root_board) return root();
+        for (unsigned i = 0; i < child_count(root()); i++) {
+            const node child = get_child(root(), i);
+            Board after = root_board;
+            after.apply(get_prev_action(child));
+            if (player != root_player && b == after) return child;
+            for (unsigned j = 0; j < child_count(child); j++) {
+                Board reply = after;
+                reply.apply(get_prev_action(get_child(child, j)));
+                if (player == root_player && b == reply) return get_child(child, j);
+            }
+        }
+        return none;
+    }
 
-    float get_win_rate() { return win_rate; }
-    void update_win_rate(float win_rate) {
-        this->win_rate += (win_rate - this->win_rate) / (visit_count + 1);
+    // keep the subtree of n only, as the tree of b with player to move
+    void reroot(node n, const Board &b, int player) {
+        root_board = b;
+        root_player = player;
+        if (n == root()) return;
+        if (spare_capacity < size()) {
+            spare_hot_memory = Region::allocate(capacity * sizeof(stats));
+            spare_link_memory = Region::allocate(capacity * sizeof(links));
+            spare_capacity = capacity;
+        }
+        stats* to_hot = reinterpret_cast<stats*>(spare_hot_memory->data());
+        links* to_link = reinterpret_cast<links*>(spare_link_memory->data());
+        copy(to_hot[0], to_link[0], hot[n], link[n]);
+        to_link[0].parent = none;
+        // breadth first, so the children of each node stay contiguous
+        node count = 1;
+        for (node i = 0; i < count; i++) {
+            const node first = to_link[i].first_child;
+            const unsigned children = to_link[i].children;
+            to_link[i].first_child = children ? count : none;
+            for (unsigned c = 0; c < children; c++, count++) {
+                copy(to_hot[count], to_link[count], hot[first + c], link[first + c]);
+                to_link[count].parent = i;
+            }
+        }
+        std::swap(hot_memory, spare_hot_memory);
+        std::swap(link_memory, spare_link_memory);
+        std::swap(capacity, spare_capacity);
+        hot = to_hot;
+        link = to_link;
+        used = count;
     }
 
-    float get_state_value() { return state_value; }
-    void set_state_value(float state_value) { this->state_value = state_value; }
+    // room for count nodes with contiguous ids, none if they do not fit in the reserve
+    node allocate(unsigned count) {
+        node first = used.load(std::memory_order_relaxed);
+        do {
+            if (first + size_t(count) > capacity) return none;
+        } while (!used.compare_exchange_weak(first, first + count, std::memory_order_relaxed));
+        return first;
+    }
 
-    float get_softmax_value() { return softmax_value; }
-    void set_softmax_value(float softmax_value) { this->softmax_value = softmax_value; }
+    void init(node n, node parent, Action action, float softmax_value) {
+        new (&hot[n]) stats();
+        new (&link[n]) links();
+        hot[n].win_count.store(1, std::memory_order_relaxed);
+        hot[n].visit_count.store(2, std::memory_order_relaxed);
+        hot[n].virtual_loss.store(0, std::memory_order_relaxed);
+        hot[n].softmax_value = softmax_value;
+        link[n].parent = parent;
+        link[n].first_child = none;
+        link[n].child_softmax_total = 0.0f;
+        link[n].children = 0;
+        link[n].state.store(FRESH, std::memory_order_relaxed);
+        link[n].prev_action = action;
+    }
 
-    float get_child_softmax_total() { return child_softmax_total; }
-    void set_child_softmax_total(float child_softmax_total) { this->child_softmax_total = child_softmax_total; }
+    // make count nodes from first the children of n, once they are initialized
+    void publish(node n, node first, unsigned count, float child_softmax_total) {
+        link[n].first_child = first;
+        link[n].children = count;
+        link[n].child_softmax_total = child_softmax_total;
+        link[n].state.store(EXPANDED, std::memory_order_release);
+    }
 
-    int get_player() { return player; }
-    void set_player(int player) { this->player = player; }
+public:
+    node get_parent(node n) const { return link[n].parent; }
+    node get_child(node n, unsigned i) const { return link[n].first_child + i; }
+    const stats* child_stats(node n) const { return hot + link[n].first_child; }
 
-    std::vector<TreeNode>& get_all_child() { return child; }
-    TreeNode& get_child(int index) { return child.at(index); }
+    // the children are published once the state is EXPANDED
+    unsigned child_count(node n) const {
+        return link[n].state.load(std::memory_order_acquire) == EXPANDED ? link[n].children : 0;
+    }
 
-    bool is_explore() { return explore; }
-    void set_explore() { explore = true; }
+    int get_win_count(node n) const { return hot[n].win_count.load(std::memory_order_relaxed); }
+    int get_visit_count(node n) const { return hot[n].visit_count.load(std::memory_order_relaxed); }
+    float get_softmax_value(node n) const { return hot[n].softmax_value; }
+    float get_child_softmax_total(node n) const { return link[n].child_softmax_total; }
+    Action get_prev_action(node n) const { return link[n].prev_action; }
+
+    // a selected node counts as a loss for its parent until its simulation is back
+    void add_virtual_loss(node n) { hot[n].virtual_loss.fetch_add(1, std::memory_order_relaxed); }
+    void add_result(node n, bool win) {
+        hot[n].visit_count.fetch_add(1, std::memory_order_relaxed);
+        if (win) hot[n].win_count.fetch_add(1, std::memory_order_relaxed);
+        hot[n].virtual_loss.fetch_sub(1, std::memory_order_relaxed);
+    }
 
-    TreeNode get_best_child_node() {
-        return *std::max_element(child.begin(), child.end(),
-                                 [](const TreeNode A, const TreeNode B) { return A.visit_count < B.visit_count; });
+    state get_state(node n) const { return state(link[n].state.load(std::memory_order_acquire)); }
+    // move the state of n from, false if it was not from
+    bool advance(node n, state from, state to) {
+        uint8_t expected = from;
+        return link[n].state.compare_exchange_strong(expected, to, std::memory_order_acq_rel);
     }
-    TreeNode get_child_with_temperature(double rd) {
-        int total = visit_count;
-        int chosen = total * rd;
-        for(auto tmp : child){
-            if((chosen -= (tmp.get_visit_count() - 2)) <= 0) return tmp;
+
+    // the first child with the most visits
+    node get_best_child(node n) const {
+        const stats* child = child_stats(n);
+        unsigned best = 0;
+        for (unsigned i = 1; i < child_count(n); i++) {
+            if (child[best].visit_count.load(std::memory_order_relaxed) < child[i].visit_count.load(std::memory_order_relaxed)) best = i;
         }
-        return child.back();
+        return get_child(n, best);
     }
 
-    std::pair<std::string, unsigned> get_prev_action() { return prev_action; }
-    std::string get_prev_action_type () { return prev_action.first; }
-    unsigned get_prev_action_code () { return prev_action.second; }
+    // a child drawn by visits, from rd uniform in [0, 1)
+    node get_child_with_temperature(node n, double rd) const {
+        const stats* child = child_stats(n);
+        int chosen = get_visit_count(n) * rd;
+        for (unsigned i = 0; i < child_count(n); i++) {
+            if ((chosen -= (child[i].visit_count.load(std::memory_order_relaxed) - 2)) <= 0) return get_child(n, i);
+        }
+        return get_child(n, child_count(n) - 1);
+    }
 
 private:
-    TreeNode *parent;
-    Board board;
-    int win_count;
-    int visit_count;
-    float win_rate;
-    float state_value; // tuple value
-    float softmax_value;
-    float child_softmax_total;
-    int player; // current player
-    bool explore;
-    std::vector<TreeNode> child;
-    std::pair<std::string, unsigned> prev_action;
-};
-
-class Tree {
-public:
-    Tree(const Board& b) { root = TreeNode(b); }
-    TreeNode& get_root() { return root; }
+    struct links {
+        node parent;
+        node first_child;
+        float child_softmax_total;
+        uint8_t children;
+        std::atomic<uint8_t> state;
+        Action prev_action;
+    };
+
+    static void copy(stats& to_hot, links& to_link, const stats& from_hot, const links& from_link) {
+        new (&to_hot) stats();
+        new (&to_link) links();
+        to_hot.win_count.store(from_hot.win_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to_hot.visit_count.store(from_hot.visit_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to_hot.virtual_loss.store(0, std::memory_order_relaxed);
+        to_hot.softmax_value = from_hot.softmax_value;
+        to_link.parent = from_link.parent;
+        to_link.first_child = from_link.first_child;
+        to_link.child_softmax_total = from_link.child_softmax_total;
+        to_link.children = from_link.children;
+        to_link.state.store(from_link.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to_link.prev_action = from_link.prev_action;
+    }
 
 private:
-    TreeNode root;
+    Board root_board;
+    int root_player;
+    stats* hot;
+    links* link;
+    size_t capacity;
+    std::atomic<uint32_t> used;
+    std::shared_ptr<Region> hot_memory, link_memory;
+    std::shared_ptr<Region> spare_hot_memory, spare_link_memory;  // where reroot copies the subtree
+    size_t spare_capacity = 0;
 };
@@ -1,199 +1,1205 @@
-#pragma once
-#include <string>
-#include <sstream>
-#include <map>
-#include <fstream>
-#include <vector>
-#include "board.h"
-#include "weight.h"
-
-class Tuple {
-public:
-    Tuple(const std::string& args = "") : learning_rate(0.003f) {
-        std::stringstream ss(args);
-        for (std::string pair; ss >> pair; ) {
-            std::string key = pair.substr(0, pair.find('='));
-            std::string value = pair.substr(pair.find('=') + 1);
-            meta[key] = { value };
-        }
-        if (meta.find("alpha") != meta.end())
-            learning_rate = float(meta["alpha"]);
-        if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
-            load_weights(meta["load"]);
-        else
-            init_weight();
-    }
-    ~Tuple() {
-        if (meta.find("save") != meta.end()) // pass save=... to save to a specific file
-            save_weights(meta["save"]);
-    }
-
-    void learning_rate_decay() {
-        learning_rate *= 0.93;
-    }
-
-private:
-    typedef std::string key;
-    struct value {
-        std::string value;
-        operator std::string() const { return value; }
-        template<typename numeric, typename = typename std::enable_if<std::is_arithmetic<numeric>::value, numeric>::type>
-        operator numeric() const { return numeric(std::stod(value)); }
-    };
-    std::map<key, value> meta;
-
-private:
-    void init_weight() {
-        // 3^16 = 43046721
-        square.emplace_back(43046721);
-        small.emplace_back(43046721);
-        large.emplace_back(43046721);
-    }
-
-    void load_weights(const std::string& path) {
-        std::ifstream in(path, std::ios::in | std::ios::binary);
-        if (!in.is_open()) std::exit(-1);
-        uint32_t size;
-        in.read(reinterpret_cast<char*>(&size), sizeof(size));
-
-        square.resize(size / 3); 
-        for (Weight& w : square) in >> w;
-        small.resize(size / 3);
-        for (Weight& w : small) in >> w;
-        large.resize(size / 3);
-        for (Weight& w : large) in >> w;
-        in.close();
-    }
-
-public:
-    void save_weights(const std::string& path) {
-        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
-        if (!out.is_open()) std::exit(-1);
-        uint32_t size = square.size() * 3;
-        out.write(reinterpret_cast<char*>(&size), sizeof(size));
-
-        for (Weight& w : square) out << w;
-        for (Weight& w : small) out << w;
-        for (Weight& w : large) out << w;
-        out.close();
-    }
-
-public:
-    /**
-     * 0: states in one game
-     * 1: states from MCTS nodes
-     */
-    void train_weight(const Board &b, float result, int source = 0) {
-        if (source == 0)      set_board_value(b, result, learning_rate);
-        else if (source == 1) set_board_value(b, result, learning_rate * 0.05f);
-    }
-
-public:
-    float minimax_search(const Board &board, int player, int level, float alp, float bet) {
-        std::vector<unsigned> eats, moves;
-        eats.clear(); moves.clear();
-        board.get_possible_eat(eats, player ^ 1);
-        board.get_possible_move(moves, player ^ 1);
-
-        float value;
-        for (unsigned code : eats) {  
-            Board tmp = Board(board);
-            tmp.eat(code & 0b111111, (code >> 6) & 0b111111);
-
-            if (level <= 1) value = get_board_value(tmp, player ^ 1);
-            else            value = minimax_search(tmp, player ^ 1, level - 1, -bet, -alp);
-            alp = std::max(alp, value);
-            if (alp >= bet) return -alp;
-        }
-        for (unsigned code : moves) {
-            Board tmp = Board(board);
-            tmp.move(code & 0b111111, (code >> 6) & 0b111111);
-
-            if (level <= 1) value = get_board_value(tmp, player ^ 1);
-            else            value = minimax_search(tmp, player ^ 1, level - 1, -bet, -alp);
-            alp = std::max(alp, value);
-            if (alp >= bet) return -alp;
-        }
-        return -alp;
-    }
-
-    float get_board_value(const Board &board, const int player) {  // 0 black 1 white
-        Board b(board.get_board(0 ^ player), board.get_board(1 ^ player));
-        uint32_t o, s, l;
-        float square_v = 0.0f;
-        float small_v = 0.0f;
-        float large_v = 0.0f;
-
-        for (int i = 4; i > 0; i--){
-            board_to_tuple_index(b, o, s, l);
-            square_v += square[0][o];
-            small_v += small[0][s];
-            large_v += large[0][l];
-            b.rotate(1);
-        }
-
-        b.transpose();
-        for (int i = 4; i > 0; i--) {
-            board_to_tuple_index(b, o, s, l);
-            square_v += square[0][o];
-            small_v += small[0][s];
-            large_v += large[0][l];
-            b.rotate(1);
-        }
-        return (square_v + small_v + large_v) / 24.0f;
-    }
-
-    void set_board_value(const Board &board, float value, float alpha) {
-        Board b(board);
-        uint32_t o, s, l;
-
-        for (int i = 4; i > 0; i--) {
-            board_to_tuple_index(b, o, s, l);
-            square[0][o] += alpha * (value - square[0][o]);
-            small[0][s] += alpha * (value - small[0][s]);
-            large[0][l] += alpha * (value - large[0][l]);
-            b.rotate(1);
-        }
-
-        b.transpose();
-        for (int i = 4; i > 0; i--) {
-            board_to_tuple_index(b, o, s, l);
-            square[0][o] += alpha * (value - square[0][o]);
-            small[0][s] += alpha * (value - small[0][s]);
-            large[0][l] += alpha * (value - large[0][l]);
-            b.rotate(1);
-        }
-    }
-
-private:
-    void board_to_tuple_index(const Board &b, uint32_t &square_bit, uint32_t &small_bit, uint32_t &large_bit) {
-        const Board::data white = b.get_board(1);
-        const Board::data black = b.get_board(0);
-        square_bit = 0;
-        small_bit = 0;
-        large_bit = 0;
-        
-        for(size_t i = 0; i < 16; i++){
-            square_bit *= 3;
-            square_bit += (white >> (square_rest[i]-1)) & 2;
-            square_bit += (black >> square_rest[i]) & 1;
-            small_bit *= 3;
-            small_bit += (white >> (small_rest[i]-1)) & 2;
-            small_bit += (black >> small_rest[i]) & 1;
-            large_bit *= 3;
-            large_bit += (white >> (large_rest[i]-1)) & 2;
-            large_bit += (black >> large_rest[i]) & 1;
-        }
-    }
-
-private:
-    const unsigned square_rest[16] = { 011, 012, 013, 014, 021, 022, 023, 024,
-                                       031, 032, 033, 034, 041, 042, 043, 044 };
-    const unsigned small_rest[16] = { 012, 021, 022, 023, 024, 025, 026, 032,
-                                      042, 051, 052, 053, 054, 055, 056, 062 };
-    const unsigned large_rest[16] = { 013, 023, 031, 032, 033, 034, 035, 036,
-                                      041, 042, 043, 044, 045, 046, 053, 063 };
-
-    std::vector<Weight> square, small, large;
-    float learning_rate;
-};
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <map>
+#include <fstream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "board.h"
+#include "action.h"
+#include "movelist.h"
+#include "weight.h"
+#include "cache.h"
+#include "checkpoint.h"
+
+/**
+ * tuple indices of a position from the view of one player, for each tuple of the
+ * network on each of the 8 images, only the first Tuple::tuple_count() rows are used
+ *
+ * a move changes at most two squares, so the indices of a child are the parent's
+ * plus the ternary weights of those squares, see Tuple::update_tuple_index
+ */
+struct TupleIndex {
+    static const unsigned max_tuples = 16;
+    uint32_t value[max_tuples][8];
+};
+
+class Tuple {
+public:
+    Tuple(const std::string& args = "") : learning_rate(0.003f), weight_format(Weight::FLOAT), weight_range(16),
+        weight_pages(Region::TRANSPARENT), batched(false), slot_shift(32), update_limit(0), queued(0) {
+        std::stringstream ss(args);
+        for (std::string pair; ss >> pair; ) {
+            std::string key = pair.substr(0, pair.find('='));
+            std::string value = pair.substr(pair.find('=') + 1);
+            meta[key] = { value };
+        }
+        // pass shapes=default|compact|@file|<spec> to choose the tuples, see named_shapes
+        std::string spec = meta.find("shapes") != meta.end() ? std::string(meta["shapes"]) : "default";
+        // pass fold=1 to store one entry per symmetry class of patterns, see init_folds
+        bool fold = meta.find("fold") != meta.end() && int(meta["fold"]);
+        if (meta.find("load") != meta.end() && !read_shapes(meta["load"], spec, fold)) std::exit(-1);
+        if (!set_shapes(spec)) std::exit(-1);
+        init_folds(fold);
+        if (meta.find("index") != meta.end()) // pass index=loop|gather|pext to choose the index kernel
+            set_index_kernel(meta["index"]);
+        if (meta.find("alpha") != meta.end())
+            learning_rate = float(meta["alpha"]);
+        if (meta.find("weight") != meta.end()) // pass weight=float|int16|int8|fp16 to choose the storage format
+            Weight::parse_format(meta["weight"], weight_format);
+        if (meta.find("range") != meta.end()) // pass range=... to bound the values of fresh fixed-point tables
+            weight_range = float(meta["range"]);
+        if (meta.find("pages") != meta.end()) // pass pages=4k|thp|huge to choose the page size of the tables
+            weight_pages = meta["pages"].value == "4k" ? Region::SMALL : meta["pages"].value == "huge" ? Region::HUGETLB : Region::TRANSPARENT;
+        if (meta.find("load") != meta.end()) // pass load=... to load from a specific file
+            load_weights(meta["load"]);
+        else
+            init_weight();
+        place_weights(meta.find("numa") != meta.end() ? std::string(meta["numa"]) : "");
+        if (meta.find("warm") != meta.end()) // pass warm=N to fault in the tables with N threads
+            prefault_weights(int(meta["warm"]));
+        if (meta.find("cache") != meta.end()) // pass cache=N to cache the values in N MB, see set_cache
+            set_cache(int(meta["cache"]));
+        if (meta.find("buffer") != meta.end()) // pass buffer=N to buffer the updates of N boards, see flush_updates
+            set_update_buffer(int(meta["buffer"]));
+        // pass batch=0|1 to choose how positions are evaluated together, see set_batching
+        set_batching(meta.find("batch") != meta.end() ? int(meta["batch"]) : -1);
+    }
+    ~Tuple() {
+        flush_updates();
+        if (checkpoints) checkpoints->finish(weight_header(), weights);
+        if (meta.find("save") != meta.end()) // pass save=... to save to a specific file
+            save_weights(meta["save"]);
+    }
+
+    void learning_rate_decay() {
+        learning_rate *= 0.93;
+    }
+
+private:
+    typedef std::string key;
+    struct value {
+        std::string value;
+        operator std::string() const { return value; }
+        template<typename numeric, typename = typename std::enable_if<std::is_arithmetic<numeric>::value, numeric>::type>
+        operator numeric() const { return numeric(std::stod(value)); }
+    };
+    std::map<key, value> meta;
+
+public:
+    /**
+     * the shapes of the tuples, from shapes=... in the args or from the weight file
+     *
+     * a spec lists the tuples separated by commas, each tuple as its cells in the square
+     * notation of tournament mode, e.g. "1a1b2a2b,3c3d"; whitespace and # comments are
+     * skipped, "@path" reads the spec from a file, and two sets have names:
+     *  default: the square, small and large tuples of 16 cells, 3^16 entries each
+     *  compact: 6 tuples of 6 to 9 cells, whose tables fit in L2
+     *
+     * the cells of a tuple are kept in ascending order, the first cell is the most significant
+     */
+    static std::string named_shapes(const std::string& name) {
+        if (name == "default") return "1a1b1c1d2a2b2c2d3a3b3c3d4a4b4c4d,"
+                                      "1b2a2b2c2d2e2f3b4b5a5b5c5d5e5f6b,"
+                                      "1c2c3a3b3c3d3e3f4a4b4c4d4e4f5c6c";
+        if (name == "compact") return "1a1b1c1d1e1f,2a2b2c2d2e2f,3a3b3c3d3e3f,"
+                                      "1a1b1c2a2b2c3a3b,1a2b3c4d5e6f,2b2c2d3b3c3d4b4c4d";
+        return name;
+    }
+
+    static bool parse_shapes(std::string spec, std::vector<std::vector<unsigned>>& shapes) {
+        if (!spec.empty() && spec[0] == '@') {
+            std::ifstream in(spec.substr(1));
+            if (!in.is_open()) return false;
+            spec.clear();
+            for (std::string line; std::getline(in, line); ) spec += line.substr(0, line.find('#')) + " ";
+        }
+        spec = named_shapes(spec);
+        shapes.assign(1, {});
+        for (size_t i = 0; i < spec.size(); i++) {
+            const char c = spec[i];
+            if (c == ',') shapes.emplace_back();
+            else if (c >= '1' && c <= '6' && i + 1 < spec.size() && spec[i + 1] >= 'a' && spec[i + 1] <= 'f') {
+                shapes.back().push_back(Action::square(spec.substr(i++, 2)));
+            }
+            else if (!std::isspace(static_cast<unsigned char>(c))) return false;
+        }
+        if (shapes.size() > TupleIndex::max_tuples) return false;
+        for (std::vector<unsigned>& cells : shapes) {
+            std::sort(cells.begin(), cells.end());
+            cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+            if (cells.empty() || cells.size() > 16) return false;
+        }
+        return true;
+    }
+
+    static std::string format_shapes(const std::vector<std::vector<unsigned>>& shapes) {
+        std::string spec;
+        for (const std::vector<unsigned>& cells : shapes) {
+            if (!spec.empty()) spec += ",";
+            for (unsigned q : cells) spec += Action::square(q);
+        }
+        return spec;
+    }
+
+    size_t tuple_count() const { return shapes.size(); }
+    std::string get_shapes() const { return format_shapes(shapes); }
+
+private:
+    bool set_shapes(const std::string& spec) {
+        if (!parse_shapes(spec, shapes)) {
+            std::cerr << "bad tuple shapes: " << spec << std::endl;
+            return false;
+        }
+        init_index_delta();
+        init_index_kernel();
+        return true;
+    }
+
+    static size_t power_of_3(size_t n) {
+        size_t power = 1;
+        while (n--) power *= 3;
+        return power;
+    }
+
+    /**
+     * a symmetry of the board that maps the cells of a tuple onto themselves only permutes
+     * the cells, so the images it pairs up always hold patterns of one orbit: the weights
+     * of a pattern and of its permutations are read and trained alike and stay equal
+     *
+     * a folded table stores one entry per orbit; the images whose tuple covers the same
+     * squares are the mates of an image, and each orbit is trained by the mates holding
+     * one chosen pattern of it, so the values and the training stay those of the full table
+     *
+     * most tuples have one such symmetry, which swaps pairs of cells and fixes the others;
+     * the pattern then splits into the fixed digits f and the two sides a and b of the
+     * pairs, and the orbit {(f, a, b), (f, b, a)} is ranked by f and the unordered pair
+     * {a, b}; the fields are sums of digits like the index itself, so the TupleIndex of
+     * such a tuple holds them packed in place of the index and the deltas add to them
+     *
+     * with more symmetries, the smallest index among the mates stands for the orbit and
+     * is ranked by a bitmap of those patterns with running counts (the count before each
+     * 32 patterns in the high half of a word)
+     */
+    struct fold_table;
+    void init_folds(bool fold) {
+        const size_t count = shapes.size();
+        folds.assign(count, fold_table());
+        folded = false;
+        for (size_t t = 0; t < count; t++) {
+            fold_table& f = folds[t];
+            const size_t length = shapes[t].size();
+            f.entries = power_of_3(length);
+            if (!fold) continue;
+
+            uint64_t squares[8] = { 0 };
+            for (unsigned p = 0; p < 64; p++) {
+                for (unsigned i = 0; i < 8; i++) {
+                    if (index_delta[(p * count + t) * 8 + i]) squares[i] |= 1ULL << p;
+                }
+            }
+            for (unsigned i = 0; i < 8; i++) {
+                unsigned size = 1;
+                f.mates[i][0] = i;
+                for (unsigned j = 0; j < 8; j++) {
+                    if (j != i && squares[j] == squares[i]) f.mates[i][size++] = j;
+                }
+                f.size = size;
+            }
+            if (f.size == 1) continue;
+
+            // each mate of image 0 moves the digit e of the index to digit cell[g][e]
+            unsigned cell[8][16];
+            for (unsigned g = 1; g < f.size; g++) {
+                for (unsigned p = 0; p < 64; p++) {
+                    const uint32_t from = index_delta[(p * count + t) * 8], to = index_delta[(p * count + t) * 8 + f.mates[0][g]];
+                    if (from) cell[g][digit_of(from)] = digit_of(to);
+                }
+            }
+            if (f.size == 2) {
+                fold_pairs(f, length, cell[1]);
+                for (unsigned p = 0; p < 64; p++) {
+                    for (unsigned i = 0; i < 8; i++) {
+                        uint32_t& delta = index_delta[(p * count + t) * 8 + i];
+                        delta = fold_split(f, delta);
+                    }
+                }
+            }
+            else fold_bitmap(f, length, cell);
+            folded = true;
+        }
+    }
+
+    // the split packs f, a and b in 32 bits, from three lookups on the digits 0-5, 6-10 and 11-15
+    void fold_pairs(fold_table& f, size_t length, const unsigned* cell) {
+        unsigned fixed_digits = 0, side_digits = 0;
+        for (unsigned e = 0; e < length; e++) {
+            if (cell[e] == e) fixed_digits++;
+            else if (cell[e] > e) side_digits++;
+        }
+        const uint32_t fixed = power_of_3(fixed_digits), side = power_of_3(side_digits);
+        f.side_shift = f.side_bits = 0;
+        while ((1u << f.side_shift) < fixed) f.side_shift++;
+        while ((1u << f.side_bits) < side) f.side_bits++;
+
+        f.split.assign(729 + 243 + 243, 0);
+        uint32_t fixed_weight = 1, side_weight = 1;
+        for (unsigned e = 0; e < length; e++) {
+            const bool paired = cell[e] > e;
+            if (cell[e] < e) continue;
+            const uint32_t weight = paired ? side_weight : fixed_weight;
+            (paired ? side_weight : fixed_weight) *= 3;
+            for (size_t x = 0; x < f.split.size(); x++) {
+                const size_t value = x < 729 ? x : x < 972 ? (x - 729) * 729 : (x - 972) * 177147;
+                if (!paired) f.split[x] += value / power_of_3(e) % 3 * weight;
+                else f.split[x] += (value / power_of_3(e) % 3 * weight) << f.side_shift |
+                                   (value / power_of_3(cell[e]) % 3 * weight) << (f.side_shift + f.side_bits);
+            }
+        }
+        f.pairs = side * (side + 1) / 2;
+        f.entries = fixed * f.pairs;
+    }
+
+    void fold_bitmap(fold_table& f, size_t length, const unsigned (*cell)[16]) {
+        // the permuted index is the sum of two lookups, on the low 8 digits and the others
+        const size_t low = power_of_3(std::min<size_t>(length, 8)), high = f.entries / low;
+        std::vector<uint32_t> low_perm((f.size - 1) * low), high_perm((f.size - 1) * high);
+        for (unsigned g = 1; g < f.size; g++) {
+            for (size_t x = 0; x < low; x++) {
+                uint32_t& v = low_perm[(g - 1) * low + x];
+                for (size_t e = 0, d = x; e < 8 && e < length; e++, d /= 3) v += (d % 3) * power_of_3(cell[g][e]);
+            }
+            for (size_t x = 0; x < high; x++) {
+                uint32_t& v = high_perm[(g - 1) * high + x];
+                for (size_t e = 8, d = x; e < length; e++, d /= 3) v += (d % 3) * power_of_3(cell[g][e]);
+            }
+        }
+
+        f.memory = Region::allocate((f.entries + 31) / 32 * sizeof(uint64_t), weight_pages);
+        uint64_t* const rank = reinterpret_cast<uint64_t*>(f.memory->data());
+        uint32_t base = 0;
+        for (size_t h = 0, p = 0; h < high; h++) {
+            for (size_t l = 0; l < low; l++, p++) {
+                if (p % 32 == 0) rank[p / 32] = uint64_t(base) << 32;
+                bool smallest = true;
+                for (unsigned g = 1; g < f.size && smallest; g++) {
+                    smallest = high_perm[(g - 1) * high + h] + low_perm[(g - 1) * low + l] >= p;
+                }
+                if (smallest) {
+                    rank[p / 32] |= 1ULL << (p % 32);
+                    base++;
+                }
+            }
+        }
+        f.rank = rank;
+        f.entries = base;
+    }
+
+    // the digit of a power of 3
+    static unsigned digit_of(uint32_t power) {
+        unsigned e = 0;
+        while (power >= 3) power /= 3, e++;
+        return e;
+    }
+
+    // the smallest index among the mates of image i
+    uint32_t fold_min(const TupleIndex &index, size_t t, unsigned i) const {
+        const fold_table& f = folds[t];
+        uint32_t p = index.value[t][i];
+        for (unsigned k = 1; k < f.size; k++) p = std::min(p, index.value[t][f.mates[i][k]]);
+        return p;
+    }
+
+    /**
+     * the entry of the orbit of v, the value of a folded tuple in a TupleIndex: the packed
+     * fields for one symmetry, or a pattern that must be the smallest of its orbit
+     */
+    uint32_t fold_rank(size_t t, uint32_t v) const {
+        const fold_table& f = folds[t];
+        if (f.rank) {
+            const uint64_t r = f.rank[v / 32];
+            return uint32_t(r >> 32) + __builtin_popcount(uint32_t(r) & ((1u << (v % 32)) - 1));
+        }
+        return fold_pair_rank(f, v);
+    }
+
+    // the packed fields of pattern p
+    static uint32_t fold_split(const fold_table& f, uint32_t p) {
+        return f.split[p % 729] + f.split[729 + p / 729 % 243] + f.split[972 + p / 177147];
+    }
+
+    static uint32_t fold_pair_rank(const fold_table& f, uint32_t s) {
+        return fold_pair_rank(s, f.side_shift, f.side_bits, f.pairs);
+    }
+
+    // branch-free, a and b compare either way about as often
+    static uint32_t fold_pair_rank(uint32_t s, unsigned shift, unsigned bits, uint32_t pairs) {
+        const uint32_t a = (s >> shift) & ((1u << bits) - 1), b = s >> (shift + bits);
+        const uint32_t high = a > b ? a : b, low = a + b - high;
+        return (s & ((1u << shift) - 1)) * pairs + high * (high + 1) / 2 + low;
+    }
+
+    // whether v is the one of its orbit that trains the entry, see init_folds
+    bool fold_trains(size_t t, uint32_t v) const {
+        const fold_table& f = folds[t];
+        if (f.rank) return f.rank[v / 32] >> (v % 32) & 1;
+        const uint32_t s = v;
+        return ((s >> f.side_shift) & ((1u << f.side_bits) - 1)) <= s >> (f.side_shift + f.side_bits);
+    }
+
+    // the entries of a position, but the smallest patterns yet to rank for the bitmaps
+    const uint32_t* fold_entries(const TupleIndex &index, uint32_t* entry) const {
+        for (size_t t = 0; t < shapes.size(); t++) {
+            const fold_table& f = folds[t];
+            uint32_t* const e = entry + t * 8;
+            if (f.size == 1) {
+                std::memcpy(e, index.value[t], sizeof(index.value[t]));
+            }
+            else if (f.rank) {
+                for (unsigned i = 0; i < 8; i++) e[i] = fold_min(index, t, i);
+            }
+            else {
+                const unsigned shift = f.side_shift, bits = f.side_bits;
+                const uint32_t pairs = f.pairs;
+                uint32_t v[8];
+                std::memcpy(v, index.value[t], sizeof(v));
+                for (unsigned i = 0; i < 8; i++) v[i] = fold_pair_rank(v[i], shift, bits, pairs);
+                std::memcpy(e, v, sizeof(v));
+            }
+        }
+        return entry;
+    }
+
+    // keep one entry per orbit of a full table
+    void fold_weights() {
+        for (size_t t = 0; t < weights.size(); t++) {
+            const fold_table& f = folds[t];
+            const Weight& full = weights[t];
+            if (f.size == 1 || full.size() != power_of_3(shapes[t].size())) continue;
+            Weight w(f.entries, full.get_format(), full.get_scale(), weight_pages);
+            const size_t width = Weight::width(full.get_format());
+            for (uint32_t p = 0; p < full.size(); p++) {
+                const uint32_t v = f.rank ? p : fold_split(f, p);
+                if (fold_trains(t, v)) std::memcpy(w.data<char>() + width * fold_rank(t, v), full.data<char>() + width * p, width);
+            }
+            weights[t] = std::move(w);
+        }
+    }
+
+    void init_weight() {
+        const float scale = Weight::scale_of(weight_format, weight_range);
+        weights.clear();
+        for (const fold_table& f : folds) weights.emplace_back(f.entries, weight_format, scale, weight_pages);
+    }
+
+    /**
+     * the weight file starts with the number of tables as uint32, then the tables; a file
+     * of other shapes than the default sets the top bit of the number and puts the spec
+     * between them, as its length as uint32 and the text padded with zeros to 8 bytes,
+     * and a file of folded tables sets the next bit
+     *
+     * return the size of the header, 0 if the file cannot be read
+     */
+    static size_t read_header(std::istream& in, uint32_t& count, std::string& spec, bool& fold) {
+        uint32_t size = 0, length = 0;
+        if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))) return 0;
+        count = size & ~(spec_flag | fold_flag);
+        spec = "default";
+        fold = size & fold_flag;
+        if (!(size & spec_flag)) return sizeof(size);
+        if (!in.read(reinterpret_cast<char*>(&length), sizeof(length))) return 0;
+        std::string text((length + 7) / 8 * 8, '\0');
+        if (!in.read(&text[0], text.size())) return 0;
+        spec = text.substr(0, length);
+        return sizeof(size) + sizeof(length) + text.size();
+    }
+
+    // the shapes of a weight file win over shapes=... in the args, and folded tables stay folded
+    bool read_shapes(const std::string& path, std::string& spec, bool& fold) {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        uint32_t count;
+        std::string file_spec;
+        bool file_fold;
+        if (!read_header(in, count, file_spec, file_fold)) return false;
+        fold |= file_fold;
+        std::vector<std::vector<unsigned>> want, got;
+        if (meta.find("shapes") != meta.end() && (!parse_shapes(spec, want) || !parse_shapes(file_spec, got) || want != got))
+            std::cerr << "tuple shapes from " << path << " replace shapes=" << spec << std::endl;
+        spec = file_spec;
+        return true;
+    }
+
+    /**
+     * the file is mapped rather than read, pass map=... to choose how
+     *  private: copy-on-write, the tables can be trained (default)
+     *  shared : read-only, one physical copy for all processes, for inference only
+     *  off    : read into anonymous memory
+     *
+     * the deltas of a checkpoint are replayed on its base, so it is mapped private then
+     *
+     * the tables are converted to the storage format whatever the format of the file,
+     * and full tables are folded with fold=1
+     */
+    void load_weights(const std::string& path) {
+        std::string how = meta.find("map") != meta.end() ? std::string(meta["map"]) : "private";
+        Checkpoint::recover(path);
+        if (how == "shared" && Checkpoint::pending(path)) how = "private";
+        if (how == "off") read_weights(path);
+        else if (!map_weights(path, how == "shared" ? Region::SHARED : Region::PRIVATE)) std::exit(-1);
+        Checkpoint::replay(path, weights);
+
+        if (folded) fold_weights();
+        for (size_t t = 0; t < weights.size(); t++) {
+            if (weights[t].size() != folds[t].entries) std::exit(-1);
+        }
+        for (Weight& w : weights) w.convert(weight_format, weight_range, weight_pages);
+    }
+
+    void read_weights(const std::string& path) {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        uint32_t count;
+        std::string spec;
+        bool fold;
+        if (!read_header(in, count, spec, fold) || count != shapes.size()) std::exit(-1);
+
+        weights.resize(count);
+        for (Weight& w : weights) in >> w;
+        in.close();
+    }
+
+    bool map_weights(const std::string& path, Region::mode how) {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        uint32_t count;
+        std::string spec;
+        bool fold;
+        size_t offset = read_header(in, count, spec, fold);
+        if (!offset || count != shapes.size()) return false;
+        std::shared_ptr<Region> file = Region::map(path, how);
+        if (!file) return false;
+
+        weights.resize(count);
+        for (Weight& w : weights) {
+            if ((offset = w.view(file, offset)) == 0) return false;
+        }
+        return true;
+    }
+
+    /**
+     * pass numa=... to place the tables on a multi-socket host
+     *  interleave: spread the pages of the tables over all nodes
+     *  replicate : one copy of the tables per node, each thread reads the copy of its node
+     *              and training writes all of them; best with pinned threads
+     * the default leaves the pages where they are first touched
+     */
+    void place_weights(const std::string& policy) {
+        numa_policy = "first touch";
+        nodes.clear();
+        for (Weight& w : weights) nodes.push_back(&w);
+        const unsigned count = Region::numa_nodes();
+        if (count < 2 || policy.empty()) return;
+
+        if (policy == "interleave") {
+            bool done = true;
+            for (Weight& w : weights) done &= w.interleave();
+            numa_policy = done ? "interleaved over " + std::to_string(count) + " nodes" : "interleave failed, first touch";
+        }
+        else if (policy == "replicate") {
+            replicas.clear();
+            replicas.reserve((count - 1) * weights.size());
+            for (unsigned node = 1; node < count; node++) {
+                for (const Weight& w : weights) replicas.emplace_back(w, weight_pages, node);
+            }
+            for (Weight& w : replicas) nodes.push_back(&w);
+            numa_policy = "replicated on " + std::to_string(count) + " nodes";
+        }
+    }
+
+    void prefault_weights(unsigned threads) {
+        for (const Weight& w : weights) w.prefault(threads);
+    }
+
+public:
+    /**
+     * cache the values of positions in a shared table of megabytes, 0 turns it off
+     *
+     * training drops the whole cache on each update, so it pays off for frozen weights
+     */
+    void set_cache(size_t megabytes) { cache.resize(megabytes); }
+    std::string cache_stats() const { return cache.enabled() ? cache.stats() : "off"; }
+
+    // the page size and placement the tables actually got
+    std::string placement() const {
+        std::stringstream ss;
+        std::vector<std::pair<const char*, size_t>> ranges;
+        for (const std::vector<Weight>* table : { &weights, &replicas }) {
+            for (const Weight& w : *table) ranges.push_back(w.range());
+        }
+        size_t folds_count = 0, rank_bytes = 0;
+        for (const fold_table& f : folds) {
+            folds_count += f.size > 1;
+            rank_bytes += f.split.size() * sizeof(uint32_t) + (f.memory ? f.memory->size() : 0);
+        }
+        ss << tuple_count() << " tuples";
+        if (folded) ss << " (" << folds_count << " folded, " << rank_bytes / 1024 << " kB of ranks)";
+        ss << ", " << get_weight_format() << " weights, " << get_weight_bytes() / 1048576 << " MB, "
+           << Region::backing(ranges, weights[0].get_pages()) << ", numa " << numa_policy;
+        return ss.str();
+    }
+
+public:
+    /**
+     * the tables are saved in the storage format
+     *
+     * the file is written aside and renamed over path, so a mapping of the old file stays valid,
+     * and it replaces a checkpoint at path with its deltas
+     */
+    void save_weights(const std::string& path) {
+        const std::string temp = path + ".tmp";
+        std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) std::exit(-1);
+        const std::string header = weight_header();
+        out.write(header.data(), header.size());
+        for (Weight& w : weights) out << w;
+        out.close();
+        if (!out || !Checkpoint::replace(temp, path)) std::exit(-1);
+    }
+
+    /**
+     * save to path in the background, only the chunks changed since the last checkpoint,
+     * see Checkpoint; pass compact=N to compact the deltas into the file every N checkpoints,
+     * and slice=N to copy a new base N MB per checkpoint
+     *
+     * return false if the previous checkpoint is still being written, the changes since go
+     * in the next one; the last checkpoint is compacted into a plain file on destruction
+     *
+     * with a snapshot path, the checkpoint is also left there as a plain weight file, by this
+     * checkpoint or, if it is skipped, the next one
+     */
+    bool checkpoint(const std::string& path, const std::string& snapshot = "") {
+        flush_updates();
+        if (checkpoints && checkpoints->get_path() != path) checkpoints->finish(weight_header(), weights);
+        if (!checkpoints || checkpoints->get_path() != path)
+            checkpoints.reset(new Checkpoint(path, meta.find("compact") != meta.end() ? int(meta["compact"]) : 8,
+                                             meta.find("slice") != meta.end() ? size_t(meta["slice"]) << 20 : size_t(64) << 20));
+        return checkpoints->save(weight_header(), weights, false, snapshot);
+    }
+    std::string checkpoint_stats() const { return checkpoints ? checkpoints->stats() : "off"; }
+
+private:
+    // the start of a weight file, see read_header
+    std::string weight_header() const {
+        const std::string spec = get_shapes();
+        uint32_t size = weights.size() | (folded ? fold_flag : 0);
+        if (spec == named_shapes("default")) return std::string(reinterpret_cast<char*>(&size), sizeof(size));
+        size |= spec_flag;
+        uint32_t length = spec.size();
+        std::string header(reinterpret_cast<char*>(&size), sizeof(size));
+        header.append(reinterpret_cast<char*>(&length), sizeof(length));
+        return header + spec + std::string((length + 7) / 8 * 8 - length, '\0');
+    }
+
+public:
+    /**
+     * 0: states in one game
+     * 1: states from MCTS nodes
+     */
+    void train_weight(const Board &b, float result, int source = 0) {
+        if (source == 0)      set_board_value(b, result, learning_rate);
+        else if (source == 1) set_board_value(b, result, learning_rate * 0.05f);
+    }
+
+public:
+    float minimax_search(const Board &board, int player, int level, float alp, float bet) {
+        MoveList actions;
+        board.get_possible_action(actions, player ^ 1);
+
+        float value;
+        for (const Action &action : actions) {
+            Board tmp = Board(board);
+            tmp.apply(action);
+
+            if (level <= 1) value = get_board_value(tmp, player ^ 1);
+            else            value = minimax_search(tmp, player ^ 1, level - 1, -bet, -alp);
+            alp = std::max(alp, value);
+            if (alp >= bet) return -alp;
+        }
+        return -alp;
+    }
+
+    float get_board_value(const Board &board, const int player) {  // 0 black 1 white
+        return get_index_value(get_tuple_index(board, player));
+    }
+
+    float get_index_value(const TupleIndex &index) {
+        if (!cache.enabled()) return evaluate_index(index);
+        float value;
+        const uint64_t key = cache_key(index);
+        const uint64_t version = cache.current();
+        const bool hit = cache.probe(key, value);
+        cache.count(1, hit);
+        if (hit) return value;
+        value = evaluate_index(index);
+        cache.store(key, value, version);
+        return value;
+    }
+
+    /**
+     * values of n positions at once, in three phases per batch: the indices of all
+     * positions, a prefetch of every table entry, then the gather and sum, so the
+     * cache misses of different positions overlap instead of following each other
+     *
+     * tables that fit in the cache have few misses to overlap, their positions are
+     * evaluated one by one, see set_batching
+     */
+    void get_board_values(const Board* boards, size_t n, const int player, float* out) {
+        if (!batched) {
+            for (size_t i = 0; i < n; i++) out[i] = get_board_value(boards[i], player);
+            return;
+        }
+        TupleIndex index[batch_size];
+        for (size_t b = 0; b < n; b += batch_size) {
+            const size_t size = std::min(n - b, size_t(batch_size));
+            for (size_t j = 0; j < size; j++) index[j] = get_tuple_index(boards[b + j], player);
+            get_index_values(index, size, out + b);
+        }
+    }
+
+    void get_index_values(const TupleIndex* index, size_t n, float* out) {
+        if (!batched) for (size_t i = 0; i < n; i++) out[i] = get_index_value(index[i]);
+        else if (cache.enabled()) cached_index_values(index, n, out);
+        else evaluate_indices(index, n, out);
+    }
+
+    // values of the children after each of actions by player, from the indices of the parent
+    void get_action_values(const TupleIndex &index, const MoveList &actions, const int player, float* out) {
+        TupleIndex child[MoveList::capacity];
+        for (size_t i = 0; i < actions.size(); i++) {
+            copy_index(child[i], index);
+            update_tuple_index(child[i], actions[i], player, player);
+        }
+        get_index_values(child, actions.size(), out);
+    }
+
+    /**
+     * 1 evaluates positions in batches with prefetch, 0 one by one, and -1 picks batches
+     * when the tables of a node do not fit in the last level cache of the host
+     */
+    void set_batching(int batch) {
+        size_t bytes = 0;
+        for (const Weight& w : weights) bytes += w.bytes();
+        batched = batch < 0 ? bytes > last_level_cache() : batch != 0;
+    }
+    bool get_batching() const { return batched; }
+
+    std::string get_weight_format() const { return Weight::format_name(weight_format); }
+    size_t get_weight_bytes() const {
+        size_t bytes = 0;
+        for (const std::vector<Weight>* table : { &weights, &replicas }) {
+            for (const Weight& w : *table) bytes += w.bytes();
+        }
+        return bytes;
+    }
+
+    // the pieces of player count as black (1), the others as white (2)
+    TupleIndex get_tuple_index(const Board &board, const int player) const {
+        Board::data blacks[8], whites[8];
+        Board::symmetry(board.get_board(0 ^ player), board.get_board(1 ^ player), blacks, whites);
+        TupleIndex index;
+        for (int i = 0; i < 8; i++) {
+            uint32_t image[TupleIndex::max_tuples];
+            board_to_tuple_index(blacks[i], whites[i], image);
+            for (size_t t = 0; t < shapes.size(); t++) index.value[t][i] = image[t];
+        }
+        for (size_t t = 0; folded && t < shapes.size(); t++) {
+            if (folds[t].size != 2) continue;
+            for (unsigned i = 0; i < 8; i++) index.value[t][i] = fold_split(folds[t], index.value[t][i]);
+        }
+        return index;
+    }
+
+    // copy the rows in use only
+    void copy_index(TupleIndex &to, const TupleIndex &from) const {
+        std::memcpy(to.value, from.value, shapes.size() * sizeof(from.value[0]));
+    }
+
+    /**
+     * update the indices of the view of player after mover plays action
+     *
+     * the piece of mover leaves origin, lands on destination and replaces the captured
+     * piece if any, as 2 adds on each index (unsigned wrap-around cancels out)
+     */
+    void update_tuple_index(TupleIndex &index, const Action action, const int mover, const int player) const {
+        const uint32_t piece = (mover == player) ? 1 : 2;
+        const uint32_t captured = action.is_eat() ? 3 - piece : 0;
+        const size_t size = shapes.size() * 8;
+        const uint32_t* const ori = &index_delta[action.origin() * size];
+        const uint32_t* const dest = &index_delta[action.destination() * size];
+        uint32_t* const value = &index.value[0][0];
+        for (size_t k = 0; k < size; k++) {
+            value[k] += (piece - captured) * dest[k] - piece * ori[k];
+        }
+    }
+
+    // read-only (map=shared) tables are not trained
+    void set_board_value(const Board &board, float value, float alpha) {
+        if (!weights[0].writable()) return;
+        const TupleIndex index = get_tuple_index(board, 0);
+        const size_t count = shapes.size();
+        if (update_limit) {
+            for (unsigned i = 0; i < 8; i++) {
+                for (size_t t = 0; t < count; t++) {
+                    uint32_t k = index.value[t][i];
+                    if (folds[t].size > 1) {
+                        if (!fold_trains(t, k)) continue;
+                        k = fold_rank(t, k);
+                    }
+                    queue_update(uint32_t(t) << entry_bits | k, alpha, value);
+                }
+            }
+            if (++queued >= update_limit) flush_updates();
+            return;
+        }
+
+        for (unsigned i = 0; i < 8; i++) {
+            // stochastic rounding keeps the updates smaller than one step unbiased, the same on each node
+            float dither[TupleIndex::max_tuples] = { 0 };
+            if (weight_format != Weight::FLOAT) {
+                for (size_t t = 0; t < count; t++) dither[t] = random.uniform();
+            }
+            for (size_t n = 0; n < nodes.size(); n += count) {
+                for (size_t t = 0; t < count; t++) {
+                    Weight& w = *nodes[n + t];
+                    uint32_t k = index.value[t][i];
+                    // a folded entry is trained by the mates holding its chosen pattern
+                    if (folds[t].size > 1) {
+                        if (!fold_trains(t, k)) continue;
+                        k = fold_rank(t, k);
+                    }
+                    if (weight_format == Weight::FLOAT) w.data<float>()[k] += alpha * (value - w.data<float>()[k]);
+                    else w.store(k, w[k] + alpha * (value - w[k]), dither[t]);
+                    w.mark(k);
+                }
+            }
+        }
+        if (cache.enabled()) cache.invalidate();
+    }
+
+public:
+    /**
+     * with buffer=N, training queues its updates and applies them here, once N boards are
+     * queued and at the end of each training search and episode
+     *
+     * an entry is read and written once per flush: its updates compose in the order they
+     * were queued, w <- w + alpha * (target - w) each, which is w <- w * keep + add; only
+     * the values read before the flush see the old weights
+     *
+     * the entries are applied sorted by table and index (a radix sort), so each table is
+     * walked in address order
+     */
+    void flush_updates() {
+        if (pending.empty()) return;
+        for (const update& u : pending) slots[u.slot] = 0;
+        sort_updates();
+        const size_t count = shapes.size(), width = Weight::width(weight_format), ahead = 8;
+        for (size_t i = 0; i < pending.size(); i++) {
+            if (i + ahead < pending.size()) {
+                const uint32_t next = pending[i + ahead].key;
+                __builtin_prefetch(nodes[next >> entry_bits]->data<char>() + (next & entry_mask) * width, 1);
+            }
+            const update& u = pending[i];
+            const size_t t = u.key >> entry_bits, k = u.key & entry_mask;
+            const float dither = weight_format == Weight::FLOAT ? 0.5f : random.uniform();
+            for (size_t n = t; n < nodes.size(); n += count) {
+                Weight& w = *nodes[n];
+                if (weight_format == Weight::FLOAT) w.data<float>()[k] = w.data<float>()[k] * u.keep + u.add;
+                else w.store(k, w[k] * u.keep + u.add, dither);
+                w.mark(k);
+            }
+        }
+        pending.clear();
+        queued = 0;
+        if (cache.enabled()) cache.invalidate();
+    }
+
+    // buffer the updates of boards boards, 0 applies them at once
+    void set_update_buffer(size_t boards) {
+        flush_updates();
+        update_limit = boards;
+        size_t size = 1;
+        while (size < boards * shapes.size() * 8 * 2) size *= 2;
+        slots.assign(boards ? size : 0, 0);
+        slot_shift = 32;
+        for (size_t s = size; s > 1; s /= 2) slot_shift--;
+        pending.reserve(boards * shapes.size() * 8);
+        sorted.reserve(pending.capacity());
+    }
+
+private:
+    // merge an update into the pending one of its entry, found in an open-addressing table
+    void queue_update(uint32_t key, float alpha, float target) {
+        const uint32_t mask = slots.size() - 1;
+        uint32_t s = (key * 0x9E3779B1u) >> slot_shift;
+        while (slots[s] && pending[slots[s] - 1].key != key) s = (s + 1) & mask;
+        if (!slots[s]) {
+            pending.push_back({ key, s, 1, 0 });
+            slots[s] = pending.size();
+        }
+        update& u = pending[slots[s] - 1];
+        u.add = u.add * (1 - alpha) + alpha * target;
+        u.keep *= 1 - alpha;
+    }
+
+    // LSD radix sort of the pending entries by key, 8 bits per pass
+    void sort_updates() {
+        sorted.resize(pending.size());
+        for (unsigned shift = 0; shift < entry_bits + 4; shift += 8) {
+            size_t start[257] = { 0 };
+            for (const update& u : pending) start[((u.key >> shift) & 255) + 1]++;
+            if (start[((pending[0].key >> shift) & 255) + 1] == pending.size()) continue;
+            for (unsigned b = 0; b < 256; b++) start[b + 1] += start[b];
+            for (const update& u : pending) sorted[start[(u.key >> shift) & 255]++] = u;
+            pending.swap(sorted);
+        }
+    }
+
+private:
+    // the values of a table are summed before scaling, which is exact for the fixed-point formats
+    float evaluate_index(const TupleIndex &index) const {
+        switch (weight_format) {
+            case Weight::INT16: return index_value<int16_t>(index);
+            case Weight::INT8: return index_value<int8_t>(index);
+            case Weight::HALF: return index_value<Weight::half>(index);
+            default: return index_value<float>(index);
+        }
+    }
+
+    void evaluate_indices(const TupleIndex* index, size_t n, float* out) const {
+        switch (weight_format) {
+            case Weight::INT16: index_values<int16_t>(index, n, out); break;
+            case Weight::INT8: index_values<int8_t>(index, n, out); break;
+            case Weight::HALF: index_values<Weight::half>(index, n, out); break;
+            default: index_values<float>(index, n, out); break;
+        }
+    }
+
+    // probe all the positions of a batch, then evaluate the misses as one batch
+    void cached_index_values(const TupleIndex* index, size_t n, float* out) {
+        uint64_t key[batch_size];
+        TupleIndex missed[batch_size];
+        size_t slot[batch_size];
+        float values[batch_size];
+        uint64_t hits = 0;
+        for (size_t b = 0; b < n; b += batch_size) {
+            const size_t size = std::min(n - b, size_t(batch_size));
+            const uint64_t version = cache.current();
+            for (size_t j = 0; j < size; j++) {
+                key[j] = cache_key(index[b + j]);
+                cache.prefetch(key[j]);
+            }
+            size_t misses = 0;
+            for (size_t j = 0; j < size; j++) {
+                if (cache.probe(key[j], out[b + j])) continue;
+                copy_index(missed[misses], index[b + j]);
+                slot[misses++] = j;
+            }
+            evaluate_indices(missed, misses, values);
+            for (size_t m = 0; m < misses; m++) {
+                out[b + slot[m]] = values[m];
+                cache.store(key[slot[m]], values[m], version);
+            }
+            hits += size - misses;
+        }
+        cache.count(n, hits);
+    }
+
+    /**
+     * key of the cache, symmetric positions have the same indices in another image
+     * order so the key sums over the images, and the player is part of the indices
+     */
+    uint64_t cache_key(const TupleIndex &index) const {
+        uint64_t key = 0;
+        for (int i = 0; i < 8; i++) {
+            uint64_t image = 0;
+            for (size_t t = 0; t < shapes.size(); t++) image = (image ^ index.value[t][i]) * 0x9E3779B97F4A7C15ULL;
+            key += EvalCache::mix(image);
+        }
+        return key;
+    }
+
+    // the tables to read from the calling thread, one per tuple, see numa=replicate
+    Weight* const* local_tables() const {
+        const size_t count = shapes.size(), copies = nodes.size() / count;
+        return copies > 1 ? &nodes[Region::current_node() % copies * count] : &nodes[0];
+    }
+
+    template<typename T>
+    float index_value(const TupleIndex &index) const {
+        return index_value<T>(index, local_tables());
+    }
+
+    template<typename T>
+    void index_values(const TupleIndex* index, size_t n, float* out) const {
+        Weight* const* tables = local_tables();
+        const size_t count = shapes.size();
+        // the entries of folded tables, the rows packed by the number of tuples
+        uint32_t entries[batch_size * TupleIndex::max_tuples * 8];
+        for (size_t b = 0; b < n; b += batch_size) {
+            const size_t end = std::min(n, b + batch_size);
+            for (size_t j = b; j < end; j++) {
+                const uint32_t* const entry = folded ? fold_entries(index[j], entries + (j - b) * count * 8) : &index[j].value[0][0];
+                for (size_t t = 0; t < count; t++) {
+                    const T* const w = tables[t]->data<T>();
+                    for (unsigned i = 0; i < 8; i++) {
+                        if (!folds[t].rank) __builtin_prefetch(w + entry[t * 8 + i]);
+                        else __builtin_prefetch(folds[t].rank + entry[t * 8 + i] / 32);
+                    }
+                }
+            }
+            // the bitmaps of folded tables are in cache by now
+            for (size_t j = b; folded && j < end; j++) {
+                for (size_t t = 0; t < count; t++) {
+                    const T* const w = tables[t]->data<T>();
+                    for (unsigned i = 0; i < 8 && folds[t].rank; i++) {
+                        uint32_t& e = entries[((j - b) * count + t) * 8 + i];
+                        __builtin_prefetch(w + (e = fold_rank(t, e)));
+                    }
+                }
+            }
+            for (size_t j = b; j < end; j++) out[j] = entries_value<T>(folded ? entries + (j - b) * count * 8 : &index[j].value[0][0], tables);
+        }
+    }
+
+    template<typename T>
+    float index_value(const TupleIndex &index, Weight* const* tables) const {
+        if (!folded) return entries_value<T>(&index.value[0][0], tables);
+        uint32_t entry[TupleIndex::max_tuples * 8];
+        fold_entries(index, entry);
+        for (size_t t = 0; t < shapes.size(); t++) {
+            for (unsigned i = 0; i < 8 && folds[t].rank; i++) entry[t * 8 + i] = fold_rank(t, entry[t * 8 + i]);
+        }
+        return entries_value<T>(entry, tables);
+    }
+
+    // the mean of the weights over the tuples and images, entry[8 * t + i] is the entry of tuple t on image i
+    template<typename T>
+    float entries_value(const uint32_t* entry, Weight* const* tables) const {
+        const size_t count = shapes.size();
+        float value = 0.0f;
+        for (size_t t = 0; t < count; t++) {
+            const T* const w = tables[t]->data<T>();
+            float v = 0.0f;
+            for (unsigned i = 0; i < 8; i++) v += Weight::decode(w[entry[t * 8 + i]]);
+            value += v * tables[t]->get_scale();
+        }
+        return value / float(8 * count);
+    }
+
+public:
+    /**
+     * kernels of board_to_tuple_index
+     *
+     * loop  : one cell at a time, multiply by 3 and add
+     * gather: gather the cells of each tuple into a 16-bit mask per color by byte tables,
+     *         then turn the binary masks into ternary by 8-bit chunk tables
+     * pext  : same as gather, but the masks come from PEXT (BMI2)
+     *
+     * pext is used if the CPU supports BMI2 at startup, otherwise gather
+     */
+    enum index_kernel { INDEX_LOOP, INDEX_GATHER, INDEX_PEXT };
+
+    static bool support_pext() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_cpu_supports("bmi2");
+#else
+        return false;
+#endif
+    }
+
+    bool set_index_kernel(const std::string& name) {
+        if (name == "loop")   kernel = INDEX_LOOP;
+        else if (name == "gather") kernel = INDEX_GATHER;
+        else if (name == "pext" && support_pext()) kernel = INDEX_PEXT;
+        else return false;
+        return true;
+    }
+    std::string get_index_kernel() const {
+        const char* name[] = { "loop", "gather", "pext" };
+        return name[kernel];
+    }
+
+private:
+    void init_index_kernel() {
+        for (unsigned c = 0; c < 256; c++) {
+            ternary[c] = 0;
+            for (unsigned k = 0; k < 8; k++) ternary[c] = ternary[c] * 3 + ((c >> k) & 1);
+        }
+        const size_t count = shapes.size();
+        tuple_mask.assign(count, 0);
+        tuple_pad.assign(count, 0);
+        gather.assign(count * 6 * 256, 0);
+        for (size_t t = 0; t < count; t++) {
+            const std::vector<unsigned>& cells = shapes[t];
+            tuple_pad[t] = 16 - cells.size();
+            for (unsigned q : cells) tuple_mask[t] |= 1ULL << q;
+            for (unsigned j = 0; j < 6; j++) {
+                for (unsigned v = 0; v < 256; v++) {
+                    uint16_t& mask = gather[(t * 6 + j) * 256 + v];
+                    for (size_t i = 0; i < cells.size(); i++) {
+                        const unsigned q = cells[i];
+                        if (q / 8 == j + 1 && ((v >> (q % 8)) & 1)) mask |= 1 << (i + tuple_pad[t]);
+                    }
+                }
+            }
+        }
+        kernel = support_pext() ? INDEX_PEXT : INDEX_GATHER;
+    }
+
+    /**
+     * the cell i of a tuple of n cells is bit 16 - n + i of the masks and weights 3^(n - 1 - i),
+     * so the low byte holds the high ternary digits and the padding bits are zero
+     */
+    uint32_t mask_to_index(const uint32_t black, const uint32_t white) const {
+        return (ternary[white & 0xFF] * 2 + ternary[black & 0xFF]) * 6561 +
+                ternary[white >> 8] * 2 + ternary[black >> 8];
+    }
+
+    uint32_t gather_mask(const Board::data b, const size_t t) const {
+        const uint16_t* const g = &gather[t * 6 * 256];
+        return g[0 * 256 + ((b >>  8) & 0xFF)] | g[1 * 256 + ((b >> 16) & 0xFF)] |
+               g[2 * 256 + ((b >> 24) & 0xFF)] | g[3 * 256 + ((b >> 32) & 0xFF)] |
+               g[4 * 256 + ((b >> 40) & 0xFF)] | g[5 * 256 + ((b >> 48) & 0xFF)];
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("bmi2")))
+    void board_to_tuple_index_pext(const Board::data black, const Board::data white, uint32_t* index) const {
+        for (size_t t = 0; t < shapes.size(); t++) {
+            index[t] = mask_to_index(uint32_t(_pext_u64(black, tuple_mask[t])) << tuple_pad[t],
+                                     uint32_t(_pext_u64(white, tuple_mask[t])) << tuple_pad[t]);
+        }
+    }
+#else
+    void board_to_tuple_index_pext(const Board::data black, const Board::data white, uint32_t* index) const {
+        board_to_tuple_index_gather(black, white, index);
+    }
+#endif
+
+    void board_to_tuple_index_gather(const Board::data black, const Board::data white, uint32_t* index) const {
+        for (size_t t = 0; t < shapes.size(); t++) {
+            index[t] = mask_to_index(gather_mask(black, t), gather_mask(white, t));
+        }
+    }
+
+    // ternary weight of each square in each tuple index, i.e. 3^(n - 1 - i) if the square is
+    // mapped to the i-th of the n cells of the tuple by the image, otherwise 0
+    void init_index_delta() {
+        const size_t count = shapes.size();
+        index_delta.assign(64 * count * 8, 0);
+        for (unsigned p = 0; p < 64; p++) {
+            Board::data blacks[8], whites[8];
+            Board::symmetry(1ULL << p, 0, blacks, whites);
+            for (unsigned i = 0; i < 8; i++) {
+                const unsigned q = lsb_index(blacks[i]);
+                for (size_t t = 0; t < count; t++) {
+                    const std::vector<unsigned>& cells = shapes[t];
+                    uint32_t weight = 1;
+                    for (int j = int(cells.size()) - 1; j >= 0; j--, weight *= 3) {
+                        if (cells[j] == q) index_delta[(p * count + t) * 8 + i] = weight;
+                    }
+                }
+            }
+        }
+    }
+
+    // the index of each tuple on one image
+    void board_to_tuple_index(const Board::data black, const Board::data white, uint32_t* index) const {
+        switch (kernel) {
+            case INDEX_PEXT: board_to_tuple_index_pext(black, white, index); break;
+            case INDEX_GATHER: board_to_tuple_index_gather(black, white, index); break;
+            default: board_to_tuple_index_loop(black, white, index); break;
+        }
+    }
+
+    void board_to_tuple_index_loop(const Board::data black, const Board::data white, uint32_t* index) const {
+        for (size_t t = 0; t < shapes.size(); t++) {
+            uint32_t bit = 0;
+            for (unsigned q : shapes[t]) {
+                bit *= 3;
+                bit += (white >> (q - 1)) & 2;
+                bit += (black >> q) & 1;
+            }
+            index[t] = bit;
+        }
+    }
+
+private:
+    // the top bit of the number of tables in a weight file, when the spec of the shapes follows
+    static const uint32_t spec_flag = 0x80000000u;
+    // the next bit, when the tables are folded
+    static const uint32_t fold_flag = 0x40000000u;
+    // positions per prefetch batch, 16 * 24 lines stay well inside L2
+    static const size_t batch_size = 16;
+
+    // bytes of the largest cache, 8 MB if the host does not say
+    static size_t last_level_cache() {
+        for (int level : { _SC_LEVEL3_CACHE_SIZE, _SC_LEVEL2_CACHE_SIZE }) {
+            const long bytes = sysconf(level);
+            if (bytes > 0) return bytes;
+        }
+        return 8 << 20;
+    }
+
+    std::vector<std::vector<unsigned>> shapes;   // the cells of each tuple
+    std::vector<uint32_t> index_delta;           // [square][tuple][image]
+    index_kernel kernel;
+    std::vector<uint64_t> tuple_mask;
+    std::vector<unsigned> tuple_pad;
+    std::vector<uint16_t> gather;                // [tuple][byte][value]
+    uint16_t ternary[256];
+
+    std::vector<Weight> weights;                 // one table per tuple
+
+    struct fold_table {
+        unsigned size = 1;                       // images with the same squares in the tuple
+        uint8_t mates[8][8];                     // those images for each image, itself first
+        size_t entries = 0;                      // entries of the table
+        std::vector<uint32_t> split;             // one symmetry: f, a and b of chunks of the digits
+        unsigned side_shift = 0, side_bits = 0;  // one symmetry: a at side_shift, b after a
+        uint32_t pairs = 0;                      // one symmetry: unordered pairs {a, b}
+        const uint64_t* rank = nullptr;          // more symmetries: bitmap of the smallest patterns
+        std::shared_ptr<Region> memory;
+    };
+    std::vector<fold_table> folds;               // one per tuple
+    bool folded;                                 // any table folded
+    float learning_rate;
+    Weight::format weight_format;
+    float weight_range;
+    Region::pages weight_pages;
+    std::vector<Weight> replicas;                // copies for the other NUMA nodes
+    std::vector<Weight*> nodes;                  // the tables of each node, one per tuple
+    std::string numa_policy;
+    EvalCache cache;
+    bool batched;                                // see set_batching
+    FastRandom random; // for stochastic rounding
+    std::unique_ptr<Checkpoint> checkpoints;
+
+    // training updates queued by set_board_value, one per entry, the table above entry_bits of the key
+    static const unsigned entry_bits = 26;
+    static const uint32_t entry_mask = (1u << entry_bits) - 1;
+    struct update {
+        uint32_t key, slot;
+        float keep, add;
+    };
+    std::vector<update> pending, sorted;
+    std::vector<uint32_t> slots;                 // 1 + the index in pending, 0 if free
+    unsigned slot_shift;
+    size_t update_limit, queued;                 // boards
+};
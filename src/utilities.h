@@ -1,4 +1,12 @@
 #pragma once
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 // moving position offset from current position(only half)
 static const unsigned NEIGHBOR[4] = { 1, 7, 8, 9 };
@@ -70,3 +78,58 @@ inline int Bitcount(uint64_t b) {
     // b = (b & 0x3333333333333333) + ((b >> 2) & 0x3333333333333333);
     // return (((b + (b >> 4)) & 0x0f0f0f0f0f0f0f0f) * 0x0101010101010101) >> 56;
 }
+
+// index of the n-th (from 0) set bit of x
+inline int select_bit(uint64_t x, unsigned n) {
+#if defined(__BMI2__)
+    return __builtin_ctzll(_pdep_u64(1ULL << n, x));
+#else
+    while (n--) x &= x - 1;
+    return __builtin_ctzll(x);
+#endif
+}
+
+/**
+ * xorshift64* generator for playouts, much cheaper than std::default_random_engine
+ * and usable as a UniformRandomBitGenerator
+ */
+class FastRandom {
+public:
+    typedef uint32_t result_type;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
+
+    FastRandom(uint64_t seed = 1) { this->seed(seed); }
+    void seed(uint64_t seed) { state = (seed + 1) * 0x9E3779B97F4A7C15ULL | 1; }
+
+    result_type operator()() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (state * 0x2545F4914F6CDD1DULL) >> 32;
+    }
+
+    // uniform in [0, n)
+    uint32_t bounded(uint32_t n) { return (uint64_t(operator()()) * n) >> 32; }
+    // uniform in [0, 1)
+    double uniform() { return operator()() * (1.0 / 4294967296.0); }
+
+private:
+    uint64_t state;
+};
+
+// pin the calling thread to one cpu (modulo the cpus online), false if not allowed
+static inline bool pin_thread(unsigned cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::max(1u, std::thread::hardware_concurrency()), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// let the calling thread run on any cpu again, for helpers started by a pinned thread
+static inline bool unpin_thread() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
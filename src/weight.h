@@ -1,37 +1,245 @@
-#pragma once
-#include <iostream>
-#include <vector>
-#include <utility>
-
-class Weight {
-public:
-    Weight() {}
-    Weight(size_t len) : value(len) {}
-    Weight(Weight&& f) : value(std::move(f.value)) {}
-    Weight(const Weight& f) = default;
-
-    Weight& operator =(const Weight& f) = default;
-    float& operator[] (size_t i) { return value[i]; }
-    const float& operator[] (size_t i) const { return value[i]; }
-    size_t size() const { return value.size(); }
-
-public:
-    friend std::ostream& operator <<(std::ostream& out, const Weight& w) {
-        auto& value = w.value;
-        uint64_t size = value.size();
-        out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-        out.write(reinterpret_cast<const char*>(value.data()), sizeof(float) * size);
-        return out;
-    }
-    friend std::istream& operator >>(std::istream& in, Weight& w) {
-        auto &value = w.value;
-        uint64_t size = 0;
-        in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-        value.resize(size);
-        in.read(reinterpret_cast<char*>(value.data()), sizeof(float) * size);
-        return in; 
-    }
-
-protected:
-    std::vector<float> value;
-};
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include "region.h"
+
+/**
+ * a table of weights, stored as float or quantized with a per-table scale
+ *
+ *  float: 4 bytes
+ *  int16: fixed point, value = q * scale, trained with stochastic rounding
+ *  int8 : fixed point, value = q * scale, for inference
+ *  fp16 : IEEE half precision, for inference
+ *
+ * in a file, each table is its size as uint64 followed by the floats; a quantized
+ * table puts its format in the top byte of the size, then the scale and the raw values
+ *
+ * the values live in a Region: zero pages for a fresh table, or a view into a mapped
+ * weight file, so loading does not copy and untouched pages are never read
+ *
+ * training marks the chunks it changes, so a checkpoint writes only those, see Checkpoint
+ */
+class Weight {
+public:
+    enum format { FLOAT = 0, INT16 = 1, INT8 = 2, HALF = 3 };
+    struct half { uint16_t bits; };
+
+    Weight() : form(FLOAT), scale(1), count(0), raw(nullptr) {}
+    Weight(size_t len, format form = FLOAT, float scale = 1, Region::pages pages = Region::TRANSPARENT) : form(form), scale(scale), count(len),
+        region(Region::allocate(len * width(form), pages)), raw(region->data()), dirty(chunks(), 0) {}
+    Weight(Weight&& f) = default;
+    Weight(const Weight& f) : Weight(f.count, f.form, f.scale) {
+        if (f.bytes()) std::memcpy(raw, f.raw, f.bytes());
+    }
+    // a copy with its pages bound to node before they are faulted in
+    Weight(const Weight& f, Region::pages pages, unsigned node) : Weight(f.count, f.form, f.scale, pages) {
+        region->bind(node);
+        if (f.bytes()) std::memcpy(raw, f.raw, f.bytes());
+    }
+
+    Weight& operator =(const Weight& f) { return *this = Weight(f); }
+    Weight& operator =(Weight&& f) = default;
+    float operator[] (size_t i) const {
+        switch (form) {
+            case INT16: return decode(data<int16_t>()[i]) * scale;
+            case INT8: return decode(data<int8_t>()[i]) * scale;
+            case HALF: return decode(data<half>()[i]) * scale;
+            default: return data<float>()[i];
+        }
+    }
+    size_t size() const { return count; }
+    size_t bytes() const { return count * width(form); }
+    bool writable() const { return !region || region->writable(); }
+    const std::shared_ptr<Region>& get_region() const { return region; }
+    format get_format() const { return form; }
+    float get_scale() const { return scale; }
+
+    template<typename T> const T* data() const { return reinterpret_cast<const T*>(raw); }
+    template<typename T> T* data() { return reinterpret_cast<T*>(raw); }
+
+    /**
+     * store value at i, the fixed-point formats round down after adding dither,
+     * so a dither uniform in [0, 1) rounds stochastically and 0.5 rounds to nearest
+     */
+    void store(size_t i, float value, float dither = 0.5f) {
+        switch (form) {
+            case INT16: data<int16_t>()[i] = quantize(value / scale, dither, 32767); break;
+            case INT8: data<int8_t>()[i] = quantize(value / scale, dither, 127); break;
+            case HALF: data<half>()[i] = to_half(value / scale); break;
+            default: data<float>()[i] = value; break;
+        }
+    }
+
+    /**
+     * the chunks of chunk_bytes changed since they were last taken, marked and taken by
+     * the training thread only
+     */
+    static const size_t chunk_bytes = 4096;
+    size_t chunks() const { return (bytes() + chunk_bytes - 1) / chunk_bytes; }
+    void mark(size_t i) { dirty[i * width(form) / chunk_bytes] = 1; }
+    bool take(size_t chunk) {
+        const bool changed = dirty[chunk];
+        dirty[chunk] = 0;
+        return changed;
+    }
+
+    /**
+     * view the table stored at offset of a mapped weight file, without copying
+     * return the offset after the table, or 0 if the file is truncated
+     */
+    size_t view(const std::shared_ptr<Region>& file, size_t offset) {
+        uint64_t size = 0;
+        if (offset + sizeof(uint64_t) > file->size()) return 0;
+        std::memcpy(&size, file->data() + offset, sizeof(uint64_t));
+        offset += sizeof(uint64_t);
+        form = format(size >> 56);
+        count = size & ((1ULL << 56) - 1);
+        scale = 1;
+        if (form != FLOAT) {
+            if (offset + sizeof(float) > file->size()) return 0;
+            std::memcpy(&scale, file->data() + offset, sizeof(float));
+            offset += sizeof(float);
+        }
+        if (offset + bytes() > file->size()) return 0;
+        region = file;
+        raw = file->data() + offset;
+        dirty.assign(chunks(), 0);
+        return offset + bytes();
+    }
+
+    void prefault(unsigned threads) const {
+        if (region) region->prefault(raw, bytes(), threads);
+    }
+    bool interleave() { return region && region->interleave(); }
+    std::pair<const char*, size_t> range() const { return { raw, bytes() }; }
+    Region::pages get_pages() const { return region ? region->get_pages() : Region::SMALL; }
+
+    // re-encode in another format, the fixed-point scale fits the largest magnitude (or range if all zero)
+    void convert(format to, float range, Region::pages pages = Region::TRANSPARENT) {
+        if (to == form) return;
+        float peak = 0;
+        for (size_t i = 0; i < count; i++) peak = std::max(peak, std::fabs((*this)[i]));
+        Weight w(count, to, scale_of(to, peak > 0 ? peak : range), pages);
+        for (size_t i = 0; i < count; i++) w.store(i, (*this)[i]);
+        *this = std::move(w);
+    }
+
+public:
+    static size_t width(format form) {
+        const size_t bytes[] = { sizeof(float), sizeof(int16_t), sizeof(int8_t), sizeof(half) };
+        return bytes[form];
+    }
+
+    // the scale to hold values in [-range, range]
+    static float scale_of(format form, float range) {
+        if (form == INT16) return range / 32767;
+        if (form == INT8)  return range / 127;
+        return 1;
+    }
+
+    static bool parse_format(const std::string& name, format& form) {
+        if (name == "float")      form = FLOAT;
+        else if (name == "int16") form = INT16;
+        else if (name == "int8")  form = INT8;
+        else if (name == "fp16")  form = HALF;
+        else return false;
+        return true;
+    }
+    static std::string format_name(format form) {
+        const char* name[] = { "float", "int16", "int8", "fp16" };
+        return name[form];
+    }
+
+    static float decode(float v) { return v; }
+    static float decode(int16_t v) { return v; }
+    static float decode(int8_t v) { return v; }
+    static float decode(half h) {
+        // scaling by 2^112 rebiases the exponent of normal and denormal values alike, weights are finite
+        uint32_t u = (h.bits & 0x7FFFu) << 13;
+        float f;
+        std::memcpy(&f, &u, sizeof(f));
+        f *= 5.192296858534828e+33f;
+        std::memcpy(&u, &f, sizeof(u));
+        u |= (h.bits & 0x8000u) << 16;
+        std::memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+
+private:
+    static int quantize(float x, float dither, int limit) {
+        const float q = std::floor(x + dither);
+        return int(std::max(-float(limit), std::min(float(limit), q)));
+    }
+
+    // round to nearest even
+    static half to_half(float f) {
+        uint32_t u;
+        std::memcpy(&u, &f, sizeof(u));
+        const uint32_t sign = u & 0x80000000u;
+        u ^= sign;
+        uint16_t bits;
+        if (u >= (127 + 16) << 23) {
+            bits = (u > 255u << 23) ? 0x7E00 : 0x7C00;
+        }
+        else if (u < 113 << 23) {
+            const uint32_t magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+            float magic, v;
+            std::memcpy(&magic, &magic_bits, sizeof(magic));
+            std::memcpy(&v, &u, sizeof(v));
+            v += magic;
+            std::memcpy(&u, &v, sizeof(u));
+            bits = u - magic_bits;
+        }
+        else {
+            const uint32_t odd = (u >> 13) & 1;
+            u -= uint32_t(127 - 15) << 23; // rebias the exponent
+            u += 0xFFF + odd;
+            bits = u >> 13;
+        }
+        return half{ uint16_t(bits | (sign >> 16)) };
+    }
+
+public:
+    // what a file holds before the values: the size, and the scale of a quantized table
+    std::string prefix() const {
+        const uint64_t size = count | (uint64_t(form) << 56);
+        std::string text(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+        if (form != FLOAT) text.append(reinterpret_cast<const char*>(&scale), sizeof(float));
+        return text;
+    }
+
+    friend std::ostream& operator <<(std::ostream& out, const Weight& w) {
+        const std::string prefix = w.prefix();
+        out.write(prefix.data(), prefix.size());
+        out.write(w.raw, w.bytes());
+        return out;
+    }
+    friend std::istream& operator >>(std::istream& in, Weight& w) {
+        uint64_t size = 0;
+        in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+        w.form = format(size >> 56);
+        w.count = size & ((1ULL << 56) - 1);
+        w.scale = 1;
+        if (w.form != FLOAT) in.read(reinterpret_cast<char*>(&w.scale), sizeof(float));
+        w.region = Region::allocate(w.bytes());
+        w.raw = w.region->data();
+        w.dirty.assign(w.chunks(), 0);
+        in.read(w.raw, w.bytes());
+        return in;
+    }
+
+protected:
+    format form;
+    float scale;
+    size_t count;
+    std::shared_ptr<Region> region;
+    char* raw;
+    std::vector<uint8_t> dirty;
+};